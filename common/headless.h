@@ -0,0 +1,231 @@
+#ifndef COMMON_HEADLESS_H
+#define COMMON_HEADLESS_H
+
+//Режим без окна, общий для firstLab и secondLab: кадры рисуются в pbuffer EGL
+//(на серверах без GPU - Mesa llvmpipe), анимация шагает по step() без таймера,
+//время кадра пишется в stderr. Сцену лабораторная описывает через HeadlessScene,
+//для стресс-замера - через BenchScene
+#include <GL/gl.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+struct HeadlessScene {
+    int width, height;
+    //настройка GL после создания контекста
+    void (*init)();
+    //один кадр
+    void (*display)();
+    //шаг анимации с фиксированным dt
+    void (*step)();
+};
+
+struct OffscreenContext {
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+    //код ошибки EGL, если контекст создать не удалось
+    EGLint error;
+};
+
+//освобождает и частично созданный контекст: пустые поля пропускаются
+inline void destroyOffscreenContext(OffscreenContext& offscreen) {
+    if (offscreen.display == EGL_NO_DISPLAY)
+        return;
+    eglMakeCurrent(offscreen.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (offscreen.context != EGL_NO_CONTEXT)
+        eglDestroyContext(offscreen.display, offscreen.context);
+    if (offscreen.surface != EGL_NO_SURFACE)
+        eglDestroySurface(offscreen.display, offscreen.surface);
+    eglTerminate(offscreen.display);
+    offscreen.display = EGL_NO_DISPLAY;
+    offscreen.surface = EGL_NO_SURFACE;
+    offscreen.context = EGL_NO_CONTEXT;
+}
+
+inline bool createOffscreenContext(OffscreenContext& offscreen, int width, int height) {
+    offscreen.display = EGL_NO_DISPLAY;
+    offscreen.surface = EGL_NO_SURFACE;
+    offscreen.context = EGL_NO_CONTEXT;
+    offscreen.error = EGL_SUCCESS;
+    //сначала платформа без оконной системы, иначе дисплей по умолчанию
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay)
+        offscreen.display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if (offscreen.display == EGL_NO_DISPLAY || !eglInitialize(offscreen.display, NULL, NULL)) {
+        offscreen.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (offscreen.display == EGL_NO_DISPLAY || !eglInitialize(offscreen.display, NULL, NULL)) {
+            offscreen.error = eglGetError();
+            offscreen.display = EGL_NO_DISPLAY;
+            return false;
+        }
+    }
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint count = 0;
+    const EGLint surfaceAttributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+    bool created = eglChooseConfig(offscreen.display, configAttributes, &config, 1, &count) && count > 0;
+    if (created) {
+        offscreen.surface = eglCreatePbufferSurface(offscreen.display, config, surfaceAttributes);
+        //glBegin/glEnd нужен совместимый профиль настольного GL
+        created = offscreen.surface != EGL_NO_SURFACE && eglBindAPI(EGL_OPENGL_API);
+    }
+    if (created) {
+        offscreen.context = eglCreateContext(offscreen.display, config, EGL_NO_CONTEXT, NULL);
+        created = offscreen.context != EGL_NO_CONTEXT &&
+                  eglMakeCurrent(offscreen.display, offscreen.surface, offscreen.surface, offscreen.context);
+    }
+    if (!created) {
+        //подходящей конфигурации нет - eglChooseConfig ошибки не ставит
+        offscreen.error = eglGetError();
+        if (offscreen.error == EGL_SUCCESS)
+            offscreen.error = EGL_BAD_CONFIG;
+        destroyOffscreenContext(offscreen);
+    }
+    return created;
+}
+
+//кадр в P6: строки GL идут снизу вверх, в PPM - сверху вниз
+inline void writeFrame(FILE* file, int width, int height, std::vector<unsigned char>& pixels) {
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y = height - 1; y >= 0; y--)
+        fwrite(&pixels[(size_t)y * width * 3], 1, (size_t)width * 3, file);
+}
+
+//out: NULL - только замер, "-" - поток P6 в stdout, иначе префикс файлов out0000.ppm...
+inline int runHeadless(const HeadlessScene& scene, int frames, const char* out) {
+    OffscreenContext offscreen;
+    if (!createOffscreenContext(offscreen, scene.width, scene.height)) {
+        fprintf(stderr, "Не удалось создать контекст EGL (ошибка 0x%x)\n", offscreen.error);
+        return 1;
+    }
+    scene.init();
+    std::vector<unsigned char> pixels((size_t)scene.width * scene.height * 3);
+    std::vector<double> times;
+    for (int frame = 0; frame < frames; frame++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        scene.display();
+        glFinish();
+        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        if (out && strcmp(out, "-") == 0) {
+            writeFrame(stdout, scene.width, scene.height, pixels);
+        } else if (out) {
+            char name[1024];
+            snprintf(name, sizeof(name), "%s%04d.ppm", out, frame);
+            FILE* file = fopen(name, "wb");
+            if (!file) {
+                fprintf(stderr, "Не удалось открыть %s\n", name);
+                destroyOffscreenContext(offscreen);
+                return 1;
+            }
+            writeFrame(file, scene.width, scene.height, pixels);
+            fclose(file);
+        }
+        scene.step();
+    }
+    fflush(stdout);
+    destroyOffscreenContext(offscreen);
+    if (times.empty())
+        return 0;
+    //первый кадр включает компиляцию шейдеров драйвера, считаем его отдельно
+    fprintf(stderr, "%dx%d, first frame %.3f ms\n", scene.width, scene.height, times[0]);
+    times.erase(times.begin());
+    if (times.empty())
+        return 0;
+    double total = 0;
+    for (size_t i = 0; i < times.size(); i++)
+        total += times[i];
+    std::sort(times.begin(), times.end());
+    fprintf(stderr, "%d frames: avg %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            (int)times.size(), total / times.size(), times[times.size() / 2],
+            times[std::min(times.size() - 1, times.size() * 99 / 100)], times.back());
+    return 0;
+}
+
+//Стресс-замер сцены без окна: <лабораторная>_bench [кадров] [множители сцены...]
+//На каждом множителе сцена рисуется frames раз: build - подготовка на CPU,
+//submit - вызовы GL, frame - всё вместе с glFinish. Столбцы у обеих
+//лабораторных одни и те же, таблицы сравниваются построчно
+struct BenchScene {
+    //путь отрисовки в первом столбце
+    const char* path;
+    HeadlessScene scene;
+    //сцена с множителем scale
+    void (*prepare)(int scale);
+    void (*build)();
+    void (*submit)();
+    //число капель, звёзд, деревьев и цветов в текущей сцене
+    void (*counts)(int& rain, int& stars, int& trees, int& flowers);
+};
+
+inline double median(std::vector<double>& values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+inline int runSceneBench(const BenchScene& bench, int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 20;
+    std::vector<int> scales;
+    for (int i = 2; i < argc; i++)
+        scales.push_back(atoi(argv[i]));
+    if (scales.empty())
+        scales = {1, 10, 100, 1000};
+    if (frames <= 0) {
+        fprintf(stderr, "usage: %s [frames] [scales...]\n", argv[0]);
+        return 1;
+    }
+    OffscreenContext offscreen;
+    if (!createOffscreenContext(offscreen, bench.scene.width, bench.scene.height)) {
+        fprintf(stderr, "Не удалось создать контекст EGL (ошибка 0x%x)\n", offscreen.error);
+        return 1;
+    }
+    bench.scene.init();
+    printf("%-13s %6s %8s %8s %6s %7s %10s %10s %10s %8s\n",
+           "path", "scale", "rain", "stars", "trees", "flowers", "build ms", "submit ms", "frame ms", "fps");
+    for (size_t s = 0; s < scales.size(); s++) {
+        int scale = std::max(scales[s], 1);
+        bench.prepare(scale);
+        //прогрев: компиляция шейдеров и рост буферов драйвера
+        bench.scene.display();
+        glFinish();
+        std::vector<double> buildTimes, submitTimes, frameTimes;
+        for (int frame = 0; frame < frames; frame++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bench.build();
+            std::chrono::steady_clock::time_point built = std::chrono::steady_clock::now();
+            bench.submit();
+            std::chrono::steady_clock::time_point submitted = std::chrono::steady_clock::now();
+            glFinish();
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            buildTimes.push_back(std::chrono::duration<double, std::milli>(built - start).count());
+            submitTimes.push_back(std::chrono::duration<double, std::milli>(submitted - built).count());
+            frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            bench.scene.step();
+        }
+        int rain, stars, trees, flowers;
+        bench.counts(rain, stars, trees, flowers);
+        double frameTime = median(frameTimes);
+        printf("%-13s %6d %8d %8d %6d %7d %10.3f %10.3f %10.3f %8.1f\n",
+               bench.path, scale, rain, stars, trees, flowers,
+               median(buildTimes), median(submitTimes), frameTime, 1000.0 / frameTime);
+        fflush(stdout);
+    }
+    destroyOffscreenContext(offscreen);
+    return 0;
+}
+
+#endif
@@ -1,6 +1,13 @@
 #include <GL/glut.h>
+#include <cctype>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "headless.h"
 
 const float dt = 0.005f;
 float dt_coeff = 1.0f;
@@ -12,6 +19,9 @@ const float radius = 50.0f;
 const int segments = 30;
 float t = 0.0f;
 bool isDay = true;
+bool isHeadless = false;
+//множитель числа капель, звёзд, деревьев и цветов (для стресс-замера)
+int sceneScale = 1;
 const float START_X = -radius;
 const float END_X = width + radius;
 const float BASE_Y = height * 0.3f;
@@ -25,9 +35,10 @@ struct Raindrop {
     float speed;
     float length;
 };
-Raindrop raindrops[MAX_RAINDROPS];
+std::vector<Raindrop> raindrops;
 void initRain() {
-    for (int i = 0; i < MAX_RAINDROPS; i++) {
+    raindrops.resize(MAX_RAINDROPS * sceneScale);
+    for (size_t i = 0; i < raindrops.size(); i++) {
         raindrops[i].x = rand() % width;
         raindrops[i].y = rand() % (int)(height * 0.7f) + height * 0.3f;
         raindrops[i].speed = 5 + rand() % 10;
@@ -70,10 +81,11 @@ struct Star {
 };
 
 const int NUM_STARS = 200;
-Star stars[NUM_STARS];
+std::vector<Star> stars;
 
 void initStars() {
-    for (int i = 0; i < NUM_STARS; i++) {
+    stars.resize(NUM_STARS * sceneScale);
+    for (size_t i = 0; i < stars.size(); i++) {
         stars[i].x = rand() % width;
         stars[i].y = height * 0.3f + rand() % (int)(height * 0.7f);
         stars[i].brightness = 0.5f + 0.5f * (rand() % 100) / 100.0f;
@@ -118,7 +130,7 @@ void drawInfo() {
 void updateRain() {
     if (!isRaining) return;
     
-    for (int i = 0; i < MAX_RAINDROPS; i++) {
+    for (size_t i = 0; i < raindrops.size(); i++) {
         raindrops[i].y -= raindrops[i].speed * dt_coeff;
         if (raindrops[i].y < 0) {
             raindrops[i].x = rand() % width;
@@ -134,7 +146,7 @@ void drawRain() {
     glLineWidth(1.5f);
     glBegin(GL_LINES);
     
-    for (int i = 0; i < MAX_RAINDROPS; i++) {
+    for (size_t i = 0; i < raindrops.size(); i++) {
         if (isDay) {
             glColor3f(0.8f, 0.8f, 1.0f);
         } else {
@@ -319,8 +331,9 @@ void drawGrass() {
     glVertex2f(width, height * 0.3f);
     glVertex2f(0, height * 0.3f);
     glEnd();
-    for (int i = 0; i < 15; i++) {
-        float flowerX = 50 + i * 50;
+    //следующие ряды цветов сдвинуты на пиксель вправо
+    for (int i = 0; i < 15 * sceneScale; i++) {
+        float flowerX = 50 + (i % 15) * 50 + (i / 15) % 50;
         float flowerY = 30 + 10 * sin(i);
         
         glColor3f(stem.r, stem.g, stem.b);
@@ -340,7 +353,7 @@ void drawStars() {
         glPointSize(2.0f);
         glBegin(GL_POINTS);
         
-        for (int i = 0; i < NUM_STARS; i++) {
+        for (size_t i = 0; i < stars.size(); i++) {
             float flicker = 0.7f + 0.3f * sin(t * 5 + stars[i].phase);
             float b = stars[i].brightness * flicker;
             
@@ -355,18 +368,22 @@ void drawForest() {
     float treeX[] = {50, 120, 190, 280, 350, 420, 490, 560, 630, 700, 750};
     float treeSize[] = {40, 55, 45, 60, 50, 65, 45, 55, 50, 60, 40};
     
-    for (int i = 0; i < 11; i++) {
-        drawTree(treeX[i], 150, treeSize[i], trunk, foliage);
+    //копии леса сдвинуты по x с переносом через край
+    for (int copy = 0; copy < sceneScale; copy++) {
+        for (int i = 0; i < 11; i++) {
+            drawTree(fmod(treeX[i] + copy * 47.0f, (float)width), 150, treeSize[i], trunk, foliage);
+        }
     }
     
     float smallTreeX[] = {130, 270, 410, 550, 680};
-    for (int i = 0; i < 5; i++) {
-        drawTree(smallTreeX[i], 130, 30, trunk, foliage);
+    for (int copy = 0; copy < sceneScale; copy++) {
+        for (int i = 0; i < 5; i++) {
+            drawTree(fmod(smallTreeX[i] + copy * 47.0f, (float)width), 130, 30, trunk, foliage);
+        }
     }
 }
 
-void display() {
-    updateColors();
+void drawScene() {
     glClearColor(sky.r, sky.g, sky.b, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
     float x = START_X + t * (END_X - START_X);
@@ -381,21 +398,33 @@ void display() {
     drawHouse(500, 150, 120, 150);
     drawHouse(200, 100, 80, 100);
     drawRain();
-    drawInfo();
+}
+
+void display() {
+    updateColors();
+    drawScene();
+    //шрифты GLUT без окна недоступны
+    if (!isHeadless)
+        drawInfo();
     glFlush();
 }
 
-void timer(int value) {
-    if (isPause) {
-        glutTimerFunc(16, timer, 0);
-        return;
-    }
+//один шаг анимации с фиксированным dt
+void step() {
     t += (dt * dt_coeff);
     if (t >= 1.0f) {
         t = 0.0f;
         isDay = !isDay;
     }
     updateRain();
+}
+
+void timer(int value) {
+    if (isPause) {
+        glutTimerFunc(16, timer, 0);
+        return;
+    }
+    step();
     glutPostRedisplay();
     glutTimerFunc(16, timer, 0);
 }
@@ -429,8 +458,56 @@ void init() {
     gluOrtho2D(0, width, 0, height);
 }
 
+//сцена для общего режима без окна (common/headless.h)
+const HeadlessScene headlessScene = {width, height, init, display, step};
+
+#ifdef FIRSTLAB_BENCH
+//Стресс-замер (common/headless.h): ночная сцена с дождём на каждом множителе.
+//glBegin/glEnd строит и отправляет одновременно: build здесь - только смешивание цветов
+void prepareBench(int scale) {
+    sceneScale = scale;
+    srand(1);
+    initStars();
+    isRaining = true;
+    initRain();
+    isDay = false;
+    t = 0.0f;
+}
+
+void benchCounts(int& rain, int& starCount, int& trees, int& flowers) {
+    rain = raindrops.size();
+    starCount = stars.size();
+    trees = 16 * sceneScale;
+    flowers = 15 * sceneScale;
+}
+
+int main(int argc, char** argv) {
+    isHeadless = true;
+    BenchScene bench = {"immediate", headlessScene, prepareBench, updateColors, drawScene, benchCounts};
+    return runSceneBench(bench, argc, argv);
+}
+#else
+//firstLab [--headless [кадров]] [--speed множитель] [--rain] [--out префикс|-]
 int main(int argc, char** argv) {
     initStars();
+    int headlessFrames = 0;
+    const char* out = NULL;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0)
+            headlessFrames = hasValue && isdigit((unsigned char)argv[i + 1][0]) ? atoi(argv[++i]) : 120;
+        else if (strcmp(argv[i], "--speed") == 0 && hasValue)
+            dt_coeff = atof(argv[++i]);
+        else if (strcmp(argv[i], "--rain") == 0) {
+            isRaining = true;
+            initRain();
+        } else if (strcmp(argv[i], "--out") == 0 && hasValue)
+            out = argv[++i];
+    }
+    if (headlessFrames > 0) {
+        isHeadless = true;
+        return runHeadless(headlessScene, headlessFrames, out);
+    }
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
     glutInitWindowSize(width, height);
@@ -444,4 +521,5 @@ int main(int argc, char** argv) {
     
     glutMainLoop();
     return 0;
-}
\ No newline at end of file
+}
+#endif
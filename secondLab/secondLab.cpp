@@ -1,7 +1,17 @@
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
+#include <cctype>
+#include <cstddef>
 #include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
 #include <vector>
+#include <map>
+#include <algorithm>
+#include "headless.h"
 
 const float dt = 0.005f;
 float dt_coeff = 1.0f;
@@ -13,54 +23,183 @@ const float radius = 50.0f;
 const int segments = 30;
 float t = 0.0f;
 bool isDay = true;
+bool isHeadless = false;
+//множитель числа капель, звёзд, деревьев и цветов (для стресс-замера)
+int sceneScale = 1;
 const float START_X = -radius;
 const float END_X = width + radius;
 const float BASE_Y = height * 0.3f;
 const float ARC_HEIGHT = (height-radius) - BASE_Y;
 
+//единичная окружность на seg сегментов: cos и sin считаются один раз на каждое seg
+const std::vector<float>& unitCircle(int seg) {
+    static std::map<int, std::vector<float> > circles;
+    std::vector<float>& circle = circles[seg];
+    if (circle.empty()) {
+        for (int i = 0; i <= seg; i++) {
+            float angle = 2 * PI * i / seg;
+            circle.push_back(cos(angle));
+            circle.push_back(sin(angle));
+        }
+    }
+    return circle;
+}
+
+//Ячейки палитры: вершина хранит номер ячейки, а цвет берётся в шейдере
+//из палитры, которая загружается раз в кадр (uploadPalette). OWN_COLOR -
+//собственный цвет вершины для того, что и так пересобирается каждый кадр
+const GLuint PALETTE_INDEX_ATTRIBUTE = 1;
+
+enum PaletteSlot {
+    OWN_COLOR,
+    GROUND_COLOR, STEM_COLOR, FLOWER_COLOR, HOUSE_COLOR, ROOF_COLOR,
+    DOOR_COLOR, WINDOW_COLOR, TRUNK_COLOR, FOLIAGE_COLOR,
+    PALETTE_SIZE
+};
+
+//Вершина сцены: позиция и цвет рядом, 12 байт. С -DSHORT_POSITIONS позиция -
+//16-битная фиксированная точка с 4 дробными битами (8 байт на вершину).
+//Цвета сцены непрозрачные, поэтому вместо альфы лежит ячейка палитры
+#ifdef SHORT_POSITIONS
+typedef GLshort ScenePosition;
+const GLenum SCENE_POSITION_TYPE = GL_SHORT;
+//4 дробных бита оставляют GLshort ±2047 пикселей, дальше toPosition прижимает к краю
+const float POSITION_SCALE = 16.0f;
+#else
+typedef GLfloat ScenePosition;
+const GLenum SCENE_POSITION_TYPE = GL_FLOAT;
+const float POSITION_SCALE = 1.0f;
+#endif
+
+struct SceneVertex {
+    ScenePosition x, y;
+    GLubyte r, g, b;
+    GLubyte slot;
+};
+
+inline ScenePosition toPosition(float value) {
+    if (POSITION_SCALE == 1.0f)
+        return (ScenePosition)value;
+    //округление к ближайшему без вызова lroundf; вне диапазона GLshort приведение
+    //не определено, поэтому сначала прижимаем к краю
+    float scaled = value * POSITION_SCALE + (value < 0 ? -0.5f : 0.5f);
+    return (ScenePosition)std::min(std::max(scaled, -32768.0f), 32767.0f);
+}
+
+inline GLubyte toColorByte(float value) {
+    return (GLubyte)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+//Сцена хранит вершины в буферах GL (VBO/IBO). Статическая сцена
+//пересобирается, только когда меняются её входы (см. inputsChanged),
+//динамическая переписывает буферы через glBufferSubData каждый кадр
 class VertexArrayScene {
 private:
-    std::vector<GLfloat> vertices;
-    std::vector<GLfloat> colors;
+    std::vector<SceneVertex> vertices;
     std::vector<GLuint> lineIndices;
     std::vector<GLuint> pointIndices;
     std::vector<GLuint> triangleIndices;
+    //ячейка палитры для добавляемых вершин
+    GLubyte slot;
+    
+    //индексы лежат в одном буфере: треугольники, отрезки, точки. Пока
+    //вершин не больше 65536, индексы уходят в GL 16-битными
+    GLenum usage;
+    GLuint vertexBuffer, indexBuffer;
+    size_t vertexCapacity, indexCapacity;
+    GLenum indexType;
+    size_t indexSize;
+    std::vector<GLushort> shortIndices;
+    bool dirty;
+    std::vector<float> inputs;
+    
+    //буфер растёт через glBufferData с запасом, иначе переписывается на месте
+    void reserve(GLenum target, GLuint buffer, size_t& capacity, size_t bytes) {
+        glBindBuffer(target, buffer);
+        if (bytes > capacity) {
+            capacity = std::max(bytes, capacity * 2);
+            glBufferData(target, capacity, NULL, usage);
+        }
+    }
+    
+    void upload() {
+        if (!vertexBuffer) {
+            glGenBuffers(1, &vertexBuffer);
+            glGenBuffers(1, &indexBuffer);
+        }
+        size_t vertexBytes = vertices.size() * sizeof(SceneVertex);
+        reserve(GL_ARRAY_BUFFER, vertexBuffer, vertexCapacity, vertexBytes);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertexBytes, &vertices[0]);
+        
+        size_t indexCount = triangleIndices.size() + lineIndices.size() + pointIndices.size();
+        if (vertices.size() <= 65536) {
+            indexType = GL_UNSIGNED_SHORT;
+            indexSize = sizeof(GLushort);
+            shortIndices.clear();
+            shortIndices.insert(shortIndices.end(), triangleIndices.begin(), triangleIndices.end());
+            shortIndices.insert(shortIndices.end(), lineIndices.begin(), lineIndices.end());
+            shortIndices.insert(shortIndices.end(), pointIndices.begin(), pointIndices.end());
+            reserve(GL_ELEMENT_ARRAY_BUFFER, indexBuffer, indexCapacity, indexCount * indexSize);
+            if (indexCount)
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indexCount * indexSize, &shortIndices[0]);
+            dirty = false;
+            return;
+        }
+        indexType = GL_UNSIGNED_INT;
+        indexSize = sizeof(GLuint);
+        size_t triangleBytes = triangleIndices.size() * sizeof(GLuint);
+        size_t lineBytes = lineIndices.size() * sizeof(GLuint);
+        size_t pointBytes = pointIndices.size() * sizeof(GLuint);
+        reserve(GL_ELEMENT_ARRAY_BUFFER, indexBuffer, indexCapacity, triangleBytes + lineBytes + pointBytes);
+        if (triangleBytes)
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, triangleBytes, &triangleIndices[0]);
+        if (lineBytes)
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, triangleBytes, lineBytes, &lineIndices[0]);
+        if (pointBytes)
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, triangleBytes + lineBytes, pointBytes, &pointIndices[0]);
+        dirty = false;
+    }
     
 public:
-    VertexArrayScene() {
+    VertexArrayScene(bool isStatic = false)
+        : slot(OWN_COLOR), usage(isStatic ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW),
+          vertexBuffer(0), indexBuffer(0), vertexCapacity(0), indexCapacity(0),
+          indexType(GL_UNSIGNED_INT), indexSize(sizeof(GLuint)) {
         clear();
     }
     
     void clear() {
         vertices.clear();
-        colors.clear();
         lineIndices.clear();
         pointIndices.clear();
         triangleIndices.clear();
+        dirty = true;
     }
     
-    void vertex(float x, float y) {
-        vertices.push_back(x);
-        vertices.push_back(y);
+    //true, если входы сцены изменились с прошлой сборки и её надо собрать заново
+    bool inputsChanged(const std::vector<float>& current) {
+        if (!dirty && current == inputs)
+            return false;
+        inputs = current;
+        return true;
     }
     
-    void color(float r, float g, float b) {
-        colors.push_back(r);
-        colors.push_back(g);
-        colors.push_back(b);
+    void vertex(float x, float y, float r, float g, float b) {
+        SceneVertex v = {toPosition(x), toPosition(y),
+                         toColorByte(r), toColorByte(g), toColorByte(b), slot};
+        vertices.push_back(v);
     }
     
     void addPoint(float x, float y, float r, float g, float b, bool draw = true) {
-        int currentIdx = vertices.size() / 2;
-        vertex(x, y);
-        color(r, g, b);
+        int currentIdx = vertices.size();
+        vertex(x, y, r, g, b);
         if (draw)
             pointIndices.push_back(currentIdx);
     }
     
     void addLine(float x1, float y1, float x2, float y2, 
                  float r, float g, float b) {
-        int startIdx = vertices.size() / 2;
+        int startIdx = vertices.size();
         
         addPoint(x1, y1, r, g, b, false);
         addPoint(x2, y2, r, g, b, false);
@@ -71,7 +210,7 @@ public:
 
     void addTriangle(float x1, float y1, float x2, float y2, float x3, float y3,
                  float r, float g, float b, bool filled = true) {
-        int startIdx = vertices.size() / 2;
+        int startIdx = vertices.size();
         
         addPoint(x1, y1, r, g, b, false);
         addPoint(x2, y2, r, g, b, false);
@@ -93,7 +232,7 @@ public:
     
     void addRect(float x, float y, float w, float h, 
              float r, float g, float b, bool filled = true) {
-        int startIdx = vertices.size() / 2;
+        int startIdx = vertices.size();
         
         addPoint(x, y, r, g, b, false);
         addPoint(x + w, y, r, g, b, false);
@@ -122,15 +261,15 @@ public:
     
     void addCircle(float cx, float cy, float rad, 
                float r, float g, float b, int seg = segments, bool filled = true) {
-        int startIdx = vertices.size() / 2;
+        int startIdx = vertices.size();
+        const std::vector<float>& circle = unitCircle(seg);
         
         if (filled) {
             addPoint(cx, cy, r, g, b, false);
             
             for (int i = 0; i <= seg; i++) {
-                float angle = 2 * PI * i / seg;
-                float x = cx + rad * cos(angle);
-                float y = cy + rad * sin(angle);
+                float x = cx + rad * circle[2 * i];
+                float y = cy + rad * circle[2 * i + 1];
                 addPoint(x, y, r, g, b, false);
             }
             
@@ -141,9 +280,8 @@ public:
             }
         } else {
             for (int i = 0; i <= seg; i++) {
-                float angle = 2 * PI * i / seg;
-                float x = cx + rad * cos(angle);
-                float y = cy + rad * sin(angle);
+                float x = cx + rad * circle[2 * i];
+                float y = cy + rad * circle[2 * i + 1];
                 addPoint(x, y, r, g, b, false);
             }
             
@@ -154,37 +292,87 @@ public:
         }
     }
     
+    //те же фигуры с цветом из палитры
+    void addLine(float x1, float y1, float x2, float y2, PaletteSlot paletteSlot) {
+        slot = paletteSlot;
+        addLine(x1, y1, x2, y2, 0, 0, 0);
+        slot = OWN_COLOR;
+    }
+    
+    void addTriangle(float x1, float y1, float x2, float y2, float x3, float y3,
+                 PaletteSlot paletteSlot, bool filled = true) {
+        slot = paletteSlot;
+        addTriangle(x1, y1, x2, y2, x3, y3, 0, 0, 0, filled);
+        slot = OWN_COLOR;
+    }
+    
+    void addRect(float x, float y, float w, float h, 
+             PaletteSlot paletteSlot, bool filled = true) {
+        slot = paletteSlot;
+        addRect(x, y, w, h, 0, 0, 0, filled);
+        slot = OWN_COLOR;
+    }
+    
+    void addCircle(float cx, float cy, float rad, 
+               PaletteSlot paletteSlot, int seg = segments, bool filled = true) {
+        slot = paletteSlot;
+        addCircle(cx, cy, rad, 0, 0, 0, seg, filled);
+        slot = OWN_COLOR;
+    }
+    
     void render() {
         if (vertices.empty()) return;
+        if (dirty)
+            upload();
         
         glEnableClientState(GL_VERTEX_ARRAY);
         glEnableClientState(GL_COLOR_ARRAY);
+        glEnableVertexAttribArray(PALETTE_INDEX_ATTRIBUTE);
         
-        glVertexPointer(2, GL_FLOAT, 0, &vertices[0]);
-        glColorPointer(3, GL_FLOAT, 0, &colors[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        glVertexPointer(2, SCENE_POSITION_TYPE, sizeof(SceneVertex), (const GLvoid*)offsetof(SceneVertex, x));
+        glColorPointer(3, GL_UNSIGNED_BYTE, sizeof(SceneVertex), (const GLvoid*)offsetof(SceneVertex, r));
+        glVertexAttribPointer(PALETTE_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_BYTE, GL_FALSE,
+                              sizeof(SceneVertex), (const GLvoid*)offsetof(SceneVertex, slot));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        //фиксированная точка переводится обратно в пиксели матрицей
+        if (POSITION_SCALE != 1.0f) {
+            glMatrixMode(GL_MODELVIEW);
+            glPushMatrix();
+            glScalef(1.0f / POSITION_SCALE, 1.0f / POSITION_SCALE, 1.0f);
+        }
         
+        size_t offset = 0;
         if (!triangleIndices.empty()) {
             glDrawElements(GL_TRIANGLES, triangleIndices.size(), 
-                        GL_UNSIGNED_INT, &triangleIndices[0]);
+                        indexType, (const GLvoid*)offset);
+            offset += triangleIndices.size() * indexSize;
         }
         
         if (!lineIndices.empty()) {
             glDrawElements(GL_LINES, lineIndices.size(), 
-                        GL_UNSIGNED_INT, &lineIndices[0]);
+                        indexType, (const GLvoid*)offset);
+            offset += lineIndices.size() * indexSize;
         }
         
         if (!pointIndices.empty()) {
             glDrawElements(GL_POINTS, pointIndices.size(), 
-                        GL_UNSIGNED_INT, &pointIndices[0]);
+                        indexType, (const GLvoid*)offset);
         }
         
+        if (POSITION_SCALE != 1.0f)
+            glPopMatrix();
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glDisableVertexAttribArray(PALETTE_INDEX_ATTRIBUTE);
         glDisableClientState(GL_VERTEX_ARRAY);
         glDisableClientState(GL_COLOR_ARRAY);
     }
 };
 
 VertexArrayScene backgroundScene;
-VertexArrayScene midScene;
+VertexArrayScene midScene(true);
+VertexArrayScene houseScene(true);
 VertexArrayScene foregroundScene;
 
 
@@ -196,9 +384,10 @@ struct Raindrop {
     float speed;
     float length;
 };
-Raindrop raindrops[MAX_RAINDROPS];
+std::vector<Raindrop> raindrops;
 void initRain() {
-    for (int i = 0; i < MAX_RAINDROPS; i++) {
+    raindrops.resize(MAX_RAINDROPS * sceneScale);
+    for (size_t i = 0; i < raindrops.size(); i++) {
         raindrops[i].x = rand() % width;
         raindrops[i].y = rand() % (int)(height * 0.7f) + height * 0.3f;
         raindrops[i].speed = 5 + rand() % 10;
@@ -241,10 +430,11 @@ struct Star {
 };
 
 const int NUM_STARS = 200;
-Star stars[NUM_STARS];
+std::vector<Star> stars;
 
 void initStars() {
-    for (int i = 0; i < NUM_STARS; i++) {
+    stars.resize(NUM_STARS * sceneScale);
+    for (size_t i = 0; i < stars.size(); i++) {
         stars[i].x = rand() % width;
         stars[i].y = height * 0.3f + rand() % (int)(height * 0.7f);
         stars[i].brightness = 0.5f + 0.5f * (rand() % 100) / 100.0f;
@@ -289,7 +479,7 @@ void drawInfo() {
 void updateRain() {
     if (!isRaining) return;
     
-    for (int i = 0; i < MAX_RAINDROPS; i++) {
+    for (size_t i = 0; i < raindrops.size(); i++) {
         raindrops[i].y -= raindrops[i].speed * dt_coeff;
         if (raindrops[i].y < 0) {
             raindrops[i].x = rand() % width;
@@ -302,7 +492,7 @@ void updateRain() {
 void drawRain(VertexArrayScene& scene) {
     if (!isRaining) return;
     
-    for (int i = 0; i < MAX_RAINDROPS; i++) {
+    for (size_t i = 0; i < raindrops.size(); i++) {
         float r, g, b;
         if (isDay) {
             r = 0.8f; g = 0.8f; b = 1.0f;
@@ -348,26 +538,25 @@ void updateColors() {
     }
 }
 
-void buildTree(float x, float y, float size, Color trunkColor, Color foliageColor, VertexArrayScene& scene) {
-    scene.addRect(x - size*0.1f, y, size*0.2f, size*0.5f, 
-             trunkColor.r, trunkColor.g, trunkColor.b);
+void buildTree(float x, float y, float size, PaletteSlot trunkColor, PaletteSlot foliageColor, VertexArrayScene& scene) {
+    scene.addRect(x - size*0.1f, y, size*0.2f, size*0.5f, trunkColor);
     
     float foliageY = y + size*0.5f;
     
     scene.addTriangle(x - size*0.5f, foliageY,
                  x + size*0.5f, foliageY,
                  x, foliageY + size*0.8f,
-                 foliageColor.r, foliageColor.g, foliageColor.b);
+                 foliageColor);
     
     scene.addTriangle(x - size*0.4f, foliageY + size*0.4f,
                  x + size*0.4f, foliageY + size*0.4f,
                  x, foliageY + size*1.2f,
-                 foliageColor.r, foliageColor.g, foliageColor.b);
+                 foliageColor);
     
     scene.addTriangle(x - size*0.3f, foliageY + size*0.9f,
                  x + size*0.3f, foliageY + size*0.9f,
                  x, foliageY + size*1.5f,
-                 foliageColor.r, foliageColor.g, foliageColor.b);
+                 foliageColor);
 }
 
 void buildSun(float x, float y, float radius, VertexArrayScene& scene) {
@@ -397,23 +586,23 @@ void buildMoon(float x, float y, float radius, VertexArrayScene& scene) {
 }
 
 void buildHouse(float x, float y, float w, float h, VertexArrayScene& scene) {
-    scene.addRect(x, y, w, h, house.r, house.g, house.b);
+    scene.addRect(x, y, w, h, HOUSE_COLOR);
     
     scene.addTriangle(x - w*0.1f, y + h, 
                  x + w*1.1f, y + h,
                  x + w*0.5f, y + h*1.4f,
-                 roof.r, roof.g, roof.b);
+                 ROOF_COLOR);
     
     float doorW = w * 0.3f;
     float doorH = h * 0.5f;
-    scene.addRect(x + w*0.35f, y, doorW, doorH, door.r, door.g, door.b);
+    scene.addRect(x + w*0.35f, y, doorW, doorH, DOOR_COLOR);
 
     scene.addPoint(x + w*0.5f, y + doorH*0.5f, 1.0f, 1.0f, 0.0f, true);
     
     float windowW = w * 0.25f;
     float windowH = h * 0.25f;
     scene.addRect(x + w*0.1f, y + h*0.6f, windowW, windowH, 
-             window.r, window.g, window.b);
+             WINDOW_COLOR);
 
     float winX = x + w*0.1f;
     float winY = y + h*0.6f;
@@ -427,24 +616,25 @@ void buildHouse(float x, float y, float w, float h, VertexArrayScene& scene) {
 
 void buildGrass(VertexArrayScene& scene) {
     scene.addRect(0, 0, width, height * 0.3f, 
-                  ground.r, ground.g, ground.b, true);
+                  GROUND_COLOR, true);
 
-    for (int i = 0; i < 15; i++) {
-        float flowerX = 50 + i * 50;
+    //следующие ряды цветов сдвинуты на пиксель вправо
+    for (int i = 0; i < 15 * sceneScale; i++) {
+        float flowerX = 50 + (i % 15) * 50 + (i / 15) % 50;
         float flowerY = 30 + 10 * sin(i);
         
         scene.addLine(flowerX, flowerY,
                       flowerX, flowerY + 30,
-                      stem.r, stem.g, stem.b);
+                      STEM_COLOR);
         
         scene.addCircle(flowerX, flowerY + 35, 8, 
-                        flower.r, flower.g, flower.b, 10, true);
+                        FLOWER_COLOR, 10, true);
     }
 }
 
 void buildStars(VertexArrayScene& scene) {
     if (!isDay) {
-        for (int i = 0; i < NUM_STARS; i++) {
+        for (size_t i = 0; i < stars.size(); i++) {
             float flicker = 0.7f + 0.3f * sin(t * 5 + stars[i].phase);
             float b = stars[i].brightness * flicker;
             
@@ -457,13 +647,18 @@ void buildForest(VertexArrayScene& scene) {
     float treeX[] = {50, 120, 190, 280, 350, 420, 490, 560, 630, 700, 750};
     float treeSize[] = {40, 55, 45, 60, 50, 65, 45, 55, 50, 60, 40};
     
-    for (int i = 0; i < 11; i++) {
-        buildTree(treeX[i], 150, treeSize[i], trunk, foliage, scene);
+    //копии леса сдвинуты по x с переносом через край
+    for (int copy = 0; copy < sceneScale; copy++) {
+        for (int i = 0; i < 11; i++) {
+            buildTree(fmod(treeX[i] + copy * 47.0f, (float)width), 150, treeSize[i], TRUNK_COLOR, FOLIAGE_COLOR, scene);
+        }
     }
     
     float smallTreeX[] = {130, 270, 410, 550, 680};
-    for (int i = 0; i < 5; i++) {
-        buildTree(smallTreeX[i], 130, 30, trunk, foliage, scene);
+    for (int copy = 0; copy < sceneScale; copy++) {
+        for (int i = 0; i < 5; i++) {
+            buildTree(fmod(smallTreeX[i] + copy * 47.0f, (float)width), 130, 30, TRUNK_COLOR, FOLIAGE_COLOR, scene);
+        }
     }
 }
 
@@ -478,44 +673,135 @@ void buildBackground() {
         buildMoon(x, y, radius, backgroundScene);
 }
 void buildMid() {
+    //цвета травы и леса берутся из палитры, пересборка нужна только при смене множителя
+    if (!midScene.inputsChanged(std::vector<float>(1, (float)sceneScale)))
+        return;
     midScene.clear();
     buildGrass(midScene);
     buildForest(midScene);
 }
 void buildForeground() {
+    //дома собираются один раз, каждый кадр пересобирается только дождь
+    if (houseScene.inputsChanged(std::vector<float>())) {
+        houseScene.clear();
+        buildHouse(500, 150, 120, 150, houseScene);
+        buildHouse(200, 100, 80, 100, houseScene);
+    }
     foregroundScene.clear();
-    buildHouse(500, 150, 120, 150, foregroundScene);
-    buildHouse(200, 100, 80, 100, foregroundScene);
     drawRain(foregroundScene);
 }
 
-void display() {
-    updateColors();
-    glClearColor(sky.r, sky.g, sky.b, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
+//Шейдер палитры: ячейка 0 - цвет вершины, остальные - из uniform-массива palette
+GLuint paletteProgram = 0;
+GLint paletteLocation = -1;
+
+GLuint compileShader(GLenum type, const std::string& source) {
+    GLuint shader = glCreateShader(type);
+    const char* text = source.c_str();
+    glShaderSource(shader, 1, &text, NULL);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "Ошибка компиляции шейдера: %s\n", log);
+        exit(1);
+    }
+    return shader;
+}
+
+void createPaletteProgram() {
+    std::string vertexSource =
+        "#version 120\n"
+        "attribute float paletteIndex;\n"
+        "uniform vec3 palette[" + std::to_string(PALETTE_SIZE) + "];\n"
+        "void main() {\n"
+        "    int index = int(paletteIndex);\n"
+        "    gl_FrontColor = index == 0 ? gl_Color : vec4(palette[index], 1.0);\n"
+        "    gl_Position = ftransform();\n"
+        "}\n";
+    std::string fragmentSource =
+        "#version 120\n"
+        "void main() {\n"
+        "    gl_FragColor = gl_Color;\n"
+        "}\n";
+    paletteProgram = glCreateProgram();
+    glAttachShader(paletteProgram, compileShader(GL_VERTEX_SHADER, vertexSource));
+    glAttachShader(paletteProgram, compileShader(GL_FRAGMENT_SHADER, fragmentSource));
+    glBindAttribLocation(paletteProgram, PALETTE_INDEX_ATTRIBUTE, "paletteIndex");
+    glLinkProgram(paletteProgram);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(paletteProgram, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024];
+        glGetProgramInfoLog(paletteProgram, sizeof(log), NULL, log);
+        fprintf(stderr, "Ошибка сборки шейдера: %s\n", log);
+        exit(1);
+    }
+    paletteLocation = glGetUniformLocation(paletteProgram, "palette");
+}
+
+//смешанные в updateColors() цвета - единственное, что меняется за сутки
+void uploadPalette() {
+    const Color* slots[PALETTE_SIZE] = {
+        NULL, &ground, &stem, &flower, &house, &roof, &door, &window, &trunk, &foliage
+    };
+    GLfloat palette[PALETTE_SIZE * 3] = {0};
+    for (int i = 1; i < PALETTE_SIZE; i++) {
+        palette[3 * i] = slots[i]->r;
+        palette[3 * i + 1] = slots[i]->g;
+        palette[3 * i + 2] = slots[i]->b;
+    }
+    glUniform3fv(paletteLocation, PALETTE_SIZE, palette);
+}
 
+//подготовка массивов вершин на CPU
+void buildScene() {
+    updateColors();
     buildBackground();
     buildMid();
     buildForeground();
+}
+
+//отправка готовых массивов в GL
+void renderScene() {
+    glClearColor(sky.r, sky.g, sky.b, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glUseProgram(paletteProgram);
+    uploadPalette();
     backgroundScene.render();
     midScene.render();
+    houseScene.render();
     foregroundScene.render();
+    glUseProgram(0);
+}
 
-    drawInfo();
+void display() {
+    buildScene();
+    renderScene();
+    //шрифты GLUT без окна недоступны
+    if (!isHeadless)
+        drawInfo();
     glFlush();
 }
 
-void timer(int value) {
-    if (isPause) {
-        glutTimerFunc(16, timer, 0);
-        return;
-    }
+//один шаг анимации с фиксированным dt
+void step() {
     t += (dt * dt_coeff);
     if (t >= 1.0f) {
         t = 0.0f;
         isDay = !isDay;
     }
     updateRain();
+}
+
+void timer(int value) {
+    if (isPause) {
+        glutTimerFunc(16, timer, 0);
+        return;
+    }
+    step();
     glutPostRedisplay();
     glutTimerFunc(16, timer, 0);
 }
@@ -547,10 +833,59 @@ void init() {
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     gluOrtho2D(0, width, 0, height);
+    createPaletteProgram();
+}
+
+//сцена для общего режима без окна (common/headless.h)
+const HeadlessScene headlessScene = {width, height, init, display, step};
+
+#ifdef SECONDLAB_BENCH
+//Стресс-замер (common/headless.h): ночная сцена с дождём на каждом множителе.
+//build - заполнение массивов вершин, submit - их отправка в GL
+void prepareBench(int scale) {
+    sceneScale = scale;
+    srand(1);
+    initStars();
+    isRaining = true;
+    initRain();
+    isDay = false;
+    t = 0.0f;
+}
+
+void benchCounts(int& rain, int& starCount, int& trees, int& flowers) {
+    rain = raindrops.size();
+    starCount = stars.size();
+    trees = 16 * sceneScale;
+    flowers = 15 * sceneScale;
 }
 
+int main(int argc, char** argv) {
+    isHeadless = true;
+    BenchScene bench = {"vertex-array", headlessScene, prepareBench, buildScene, renderScene, benchCounts};
+    return runSceneBench(bench, argc, argv);
+}
+#else
+//secondLab [--headless [кадров]] [--speed множитель] [--rain] [--out префикс|-]
 int main(int argc, char** argv) {
     initStars();
+    int headlessFrames = 0;
+    const char* out = NULL;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0)
+            headlessFrames = hasValue && isdigit((unsigned char)argv[i + 1][0]) ? atoi(argv[++i]) : 120;
+        else if (strcmp(argv[i], "--speed") == 0 && hasValue)
+            dt_coeff = atof(argv[++i]);
+        else if (strcmp(argv[i], "--rain") == 0) {
+            isRaining = true;
+            initRain();
+        } else if (strcmp(argv[i], "--out") == 0 && hasValue)
+            out = argv[++i];
+    }
+    if (headlessFrames > 0) {
+        isHeadless = true;
+        return runHeadless(headlessScene, headlessFrames, out);
+    }
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_SINGLE | GLUT_RGB);
     glutInitWindowSize(width, height);
@@ -564,4 +899,5 @@ int main(int argc, char** argv) {
     
     glutMainLoop();
     return 0;
-}
\ No newline at end of file
+}
+#endif
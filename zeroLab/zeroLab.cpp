@@ -5,284 +5,3409 @@
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdint>
+#include <climits>
+#include <random>
+#include <memory>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
-class Canvas {
+//Выделение памяти, выровненной под SIMD-регистры
+template <class T, size_t Alignment>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <class U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+    AlignedAllocator() {}
+    template <class U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+    T* allocate(size_t n) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, Alignment, n * sizeof(T)) != 0)
+            throw bad_alloc();
+        return static_cast<T*>(ptr);
+    }
+    void deallocate(T* ptr, size_t) {
+        free(ptr);
+    }
+    template <class U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+const unsigned int CANVAS_ALIGNMENT = 64;
+//Плитки учёта изменений холста, размеры - степени двойки
+const unsigned int DIRTY_TILE_WIDTH = 64;
+const unsigned int DIRTY_TILE_HEIGHT = 16;
+
+//Форматы пикселей холста
+typedef unsigned char Gray8;
+struct RGBA32 {
+    unsigned char r, g, b, a;
+};
+bool operator==(const RGBA32& a, const RGBA32& b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+bool operator!=(const RGBA32& a, const RGBA32& b) {
+    return !(a == b);
+}
+//1 бит на пиксель, 8 пикселей в байте, старший бит - левый пиксель
+struct Bit {};
+
+//Составление холстов: ячейка, равная фону, считается пустой.
+//Or  - непустые ячейки источника ложатся поверх (наложение спрайта),
+//And - остаются ячейки цели, непустые в обоих холстах,
+//Xor - остаются ячейки, непустые ровно в одном холсте.
+//Для Bit это обычные побитовые |, & и ^
+enum class Composite {
+    Copy,
+    Or,
+    And,
+    Xor
+};
+
+//Составление одной ячейки, key - фон
+template <class Value>
+Value compositeValue(Composite op, Value target, Value source, Value key) {
+    if (op == Composite::Copy)
+        return source;
+    bool sourceSet = !(source == key), targetSet = !(target == key);
+    if (op == Composite::Or)
+        return sourceSet ? source : target;
+    if (op == Composite::And)
+        return sourceSet && targetSet ? target : key;
+    return sourceSet ? (targetSet ? key : source) : target;
+}
+
+//Набор векторных инструкций для ядер составления, выбирается при запуске
+enum class SimdLevel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+//Ядро над строкой байтов: target[i] = op(target[i], source[i]).
+//key - байт фона для ядер с пустыми ячейками, побитовые ядра его не смотрят
+typedef void (*CompositeRow)(unsigned char* target, const unsigned char* source, size_t count, unsigned char key);
+
+template <Composite Op>
+void compositeKeyedScalar(unsigned char* target, const unsigned char* source, size_t count, unsigned char key) {
+    for (size_t i = 0; i < count; i++) {
+        unsigned char s = source[i], t = target[i];
+        if (Op == Composite::Or)
+            target[i] = s != key ? s : t;
+        else if (Op == Composite::And)
+            target[i] = s != key && t != key ? t : key;
+        else
+            target[i] = s != key ? (t != key ? key : s) : t;
+    }
+}
+
+template <Composite Op>
+void compositeBitwiseScalar(unsigned char* target, const unsigned char* source, size_t count, unsigned char) {
+    for (size_t i = 0; i < count; i++) {
+        if (Op == Composite::Or)
+            target[i] |= source[i];
+        else if (Op == Composite::And)
+            target[i] &= source[i];
+        else
+            target[i] ^= source[i];
+    }
+}
+
+#ifdef __SSE2__
+//mask ? a : b по байтам
+inline __m128i selectBytes(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+//16 ячеек за шаг: пустые ячейки находятся сравнением с фоном,
+//результат собирается выбором по маскам
+template <Composite Op>
+void compositeKeyedSSE2(unsigned char* target, const unsigned char* source, size_t count, unsigned char key) {
+    __m128i k = _mm_set1_epi8((char)key);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+        __m128i sEmpty = _mm_cmpeq_epi8(s, k);
+        __m128i result;
+        if (Op == Composite::Or)
+            result = selectBytes(sEmpty, t, s);
+        else if (Op == Composite::And)
+            result = selectBytes(_mm_or_si128(sEmpty, _mm_cmpeq_epi8(t, k)), k, t);
+        else
+            result = selectBytes(sEmpty, t, selectBytes(_mm_cmpeq_epi8(t, k), s, k));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), result);
+    }
+    compositeKeyedScalar<Op>(target + i, source + i, count - i, key);
+}
+
+template <Composite Op>
+void compositeBitwiseSSE2(unsigned char* target, const unsigned char* source, size_t count, unsigned char key) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+        __m128i result = Op == Composite::Or ? _mm_or_si128(t, s) : Op == Composite::And ? _mm_and_si128(t, s) : _mm_xor_si128(t, s);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), result);
+    }
+    compositeBitwiseScalar<Op>(target + i, source + i, count - i, key);
+}
+
+//AVX2 собирается для этих функций отдельно и вызывается, только если
+//процессор его поддерживает: остальной код остаётся на SSE2
+__attribute__((target("avx2"))) inline __m256i selectBytes256(__m256i mask, __m256i a, __m256i b) {
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+template <Composite Op>
+__attribute__((target("avx2")))
+void compositeKeyedAVX2(unsigned char* target, const unsigned char* source, size_t count, unsigned char key) {
+    __m256i k = _mm256_set1_epi8((char)key);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + i));
+        __m256i sEmpty = _mm256_cmpeq_epi8(s, k);
+        __m256i result;
+        if (Op == Composite::Or)
+            result = selectBytes256(sEmpty, t, s);
+        else if (Op == Composite::And)
+            result = selectBytes256(_mm256_or_si256(sEmpty, _mm256_cmpeq_epi8(t, k)), k, t);
+        else
+            result = selectBytes256(sEmpty, t, selectBytes256(_mm256_cmpeq_epi8(t, k), s, k));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), result);
+    }
+    compositeKeyedSSE2<Op>(target + i, source + i, count - i, key);
+}
+
+template <Composite Op>
+__attribute__((target("avx2")))
+void compositeBitwiseAVX2(unsigned char* target, const unsigned char* source, size_t count, unsigned char key) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        __m256i t = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + i));
+        __m256i result = Op == Composite::Or ? _mm256_or_si256(t, s) : Op == Composite::And ? _mm256_and_si256(t, s) : _mm256_xor_si256(t, s);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), result);
+    }
+    compositeBitwiseSSE2<Op>(target + i, source + i, count - i, key);
+}
+#endif
+
+//Ядра одного уровня: индекс - Composite::Or, And, Xor минус 1
+struct CompositeKernels {
+    CompositeRow keyed[3];
+    CompositeRow bitwise[3];
+};
+
+SimdLevel supportedSimdLevel() {
+#ifdef __SSE2__
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+//Текущий набор ядер; по умолчанию - лучший из поддерживаемых
+SimdLevel activeSimdLevel = supportedSimdLevel();
+
+//Уровень выше поддерживаемого понижается; возвращает установленный
+SimdLevel setSimdLevel(SimdLevel level) {
+    activeSimdLevel = (int)level <= (int)supportedSimdLevel() ? level : supportedSimdLevel();
+    return activeSimdLevel;
+}
+
+const CompositeKernels& compositeKernels() {
+    static const CompositeKernels scalar = {
+        {compositeKeyedScalar<Composite::Or>, compositeKeyedScalar<Composite::And>, compositeKeyedScalar<Composite::Xor>},
+        {compositeBitwiseScalar<Composite::Or>, compositeBitwiseScalar<Composite::And>, compositeBitwiseScalar<Composite::Xor>}};
+#ifdef __SSE2__
+    static const CompositeKernels sse2 = {
+        {compositeKeyedSSE2<Composite::Or>, compositeKeyedSSE2<Composite::And>, compositeKeyedSSE2<Composite::Xor>},
+        {compositeBitwiseSSE2<Composite::Or>, compositeBitwiseSSE2<Composite::And>, compositeBitwiseSSE2<Composite::Xor>}};
+    static const CompositeKernels avx2 = {
+        {compositeKeyedAVX2<Composite::Or>, compositeKeyedAVX2<Composite::And>, compositeKeyedAVX2<Composite::Xor>},
+        {compositeBitwiseAVX2<Composite::Or>, compositeBitwiseAVX2<Composite::And>, compositeBitwiseAVX2<Composite::Xor>}};
+    if (activeSimdLevel == SimdLevel::AVX2)
+        return avx2;
+    if (activeSimdLevel == SimdLevel::SSE2)
+        return sse2;
+#endif
+    return scalar;
+}
+
+//Хранение и ядра заливки/копирования для формата пикселя. Пиксели строки
+//адресуются линейным индексом y * pixelStride + x
+template <class Pixel>
+struct PixelFormat;
+
+//Пиксель - один байт: заливка через memset, копирование через memcpy
+template <class Byte>
+struct BytePixelFormat {
+    typedef Byte Value;
+    typedef Byte Storage;
+    static const unsigned int PIXELS_PER_ELEMENT = 1;
+    static void store(Storage* data, size_t index, Value value) {
+        data[index] = value;
+    }
+    static Value load(const Storage* data, size_t index) {
+        return data[index];
+    }
+    static void fill(Storage* data, size_t index, size_t count, Value value) {
+        memset(data + index, value, count);
+    }
+    static void copy(Storage* target, size_t targetIndex, const Storage* source, size_t sourceIndex, size_t count) {
+        memcpy(target + targetIndex, source + sourceIndex, count);
+    }
+    static void composite(Storage* target, size_t targetIndex, const Storage* source, size_t sourceIndex,
+                          size_t count, Composite op, Value key) {
+        if (op == Composite::Copy) {
+            copy(target, targetIndex, source, sourceIndex, count);
+            return;
+        }
+        compositeKernels().keyed[(int)op - 1](reinterpret_cast<unsigned char*>(target + targetIndex),
+                                              reinterpret_cast<const unsigned char*>(source + sourceIndex),
+                                              count, (unsigned char)key);
+    }
+};
+
+template <>
+struct PixelFormat<char> : BytePixelFormat<char> {
+    static Value background() { return ' '; }
+    static Value ink() { return '*'; }
+};
+
+template <>
+struct PixelFormat<Gray8> : BytePixelFormat<Gray8> {
+    static Value background() { return 0; }
+    static Value ink() { return 255; }
+};
+
+template <>
+struct PixelFormat<RGBA32> {
+    typedef RGBA32 Value;
+    typedef RGBA32 Storage;
+    static const unsigned int PIXELS_PER_ELEMENT = 1;
+    static void store(Storage* data, size_t index, Value value) {
+        data[index] = value;
+    }
+    static Value load(const Storage* data, size_t index) {
+        return data[index];
+    }
+    //пиксель заливается как одно 32-битное слово
+    static void fill(Storage* data, size_t index, size_t count, Value value) {
+        uint32_t word;
+        memcpy(&word, &value, sizeof(word));
+        uint32_t* target = reinterpret_cast<uint32_t*>(data + index);
+        for (size_t i = 0; i < count; i++)
+            target[i] = word;
+    }
+    static void copy(Storage* target, size_t targetIndex, const Storage* source, size_t sourceIndex, size_t count) {
+        memcpy(target + targetIndex, source + sourceIndex, count * sizeof(Storage));
+    }
+    static void composite(Storage* target, size_t targetIndex, const Storage* source, size_t sourceIndex,
+                          size_t count, Composite op, Value key) {
+        if (op == Composite::Copy) {
+            copy(target, targetIndex, source, sourceIndex, count);
+            return;
+        }
+        for (size_t i = 0; i < count; i++)
+            target[targetIndex + i] = compositeValue(op, target[targetIndex + i], source[sourceIndex + i], key);
+    }
+    static Value background() { RGBA32 value = {0, 0, 0, 255}; return value; }
+    static Value ink() { RGBA32 value = {255, 255, 255, 255}; return value; }
+};
+
+template <>
+struct PixelFormat<Bit> {
+    typedef bool Value;
+    typedef unsigned char Storage;
+    static const unsigned int PIXELS_PER_ELEMENT = 8;
+    static void store(Storage* data, size_t index, Value value) {
+        unsigned char mask = 0x80 >> (index & 7);
+        if (value)
+            data[index >> 3] |= mask;
+        else
+            data[index >> 3] &= ~mask;
+    }
+    static Value load(const Storage* data, size_t index) {
+        return (data[index >> 3] >> (7 - (index & 7))) & 1;
+    }
+    //неполные крайние байты - по маске, середина - memset
+    static void fill(Storage* data, size_t index, size_t count, Value value) {
+        if (count == 0)
+            return;
+        size_t first = index >> 3;
+        size_t last = (index + count - 1) >> 3;
+        unsigned char head = 0xFF >> (index & 7);
+        unsigned char tail = 0xFF << (7 - ((index + count - 1) & 7));
+        if (first == last) {
+            setBits(data[first], head & tail, value);
+            return;
+        }
+        setBits(data[first], head, value);
+        memset(data + first + 1, value ? 0xFF : 0x00, last - first - 1);
+        setBits(data[last], tail, value);
+    }
+    static void copy(Storage* target, size_t targetIndex, const Storage* source, size_t sourceIndex, size_t count) {
+        //при одинаковом сдвиге внутри байта середина копируется целыми байтами
+        if ((targetIndex & 7) == (sourceIndex & 7)) {
+            while (count > 0 && (targetIndex & 7) != 0) {
+                store(target, targetIndex++, load(source, sourceIndex++));
+                count--;
+            }
+            memcpy(target + (targetIndex >> 3), source + (sourceIndex >> 3), count >> 3);
+            size_t done = count & ~(size_t)7;
+            targetIndex += done;
+            sourceIndex += done;
+            count -= done;
+        }
+        for (size_t i = 0; i < count; i++)
+            store(target, targetIndex + i, load(source, sourceIndex + i));
+    }
+    //как copy: при одинаковом сдвиге внутри байта середина - побитовое ядро
+    static void composite(Storage* target, size_t targetIndex, const Storage* source, size_t sourceIndex,
+                          size_t count, Composite op, Value key) {
+        if (op == Composite::Copy) {
+            copy(target, targetIndex, source, sourceIndex, count);
+            return;
+        }
+        if ((targetIndex & 7) == (sourceIndex & 7)) {
+            while (count > 0 && (targetIndex & 7) != 0) {
+                store(target, targetIndex, compositeValue(op, load(target, targetIndex), load(source, sourceIndex), key));
+                targetIndex++;
+                sourceIndex++;
+                count--;
+            }
+            compositeKernels().bitwise[(int)op - 1](target + (targetIndex >> 3), source + (sourceIndex >> 3), count >> 3, 0);
+            size_t done = count & ~(size_t)7;
+            targetIndex += done;
+            sourceIndex += done;
+            count -= done;
+        }
+        for (size_t i = 0; i < count; i++)
+            store(target, targetIndex + i,
+                  compositeValue(op, load(target, targetIndex + i), load(source, sourceIndex + i), key));
+    }
+    static Value background() { return false; }
+    static Value ink() { return true; }
+private:
+    static void setBits(unsigned char& byte, unsigned char mask, Value value) {
+        if (value)
+            byte |= mask;
+        else
+            byte &= ~mask;
+    }
+};
+
+//Номер холста для потребителей изменений. Поколения у каждого холста свои,
+//а адрес может достаться новому холсту (например, созданному на стеке в
+//каждом кадре), поэтому потребитель узнаёт холст по номеру. Номера не
+//повторяются в пределах процесса; копия холста получает новый номер
+class CanvasId {
+private:
+    uint64_t value;
+    static uint64_t next() {
+        static atomic<uint64_t> counter(0);
+        return counter.fetch_add(1, memory_order_relaxed) + 1;
+    }
+public:
+    CanvasId() : value(next()) {}
+    CanvasId(const CanvasId&) : value(next()) {}
+    CanvasId& operator=(const CanvasId&) {
+        value = next();
+        return *this;
+    }
+    uint64_t get() const {
+        return value;
+    }
+};
+
+template <class Pixel>
+class BasicCanvas {
+public:
+    typedef PixelFormat<Pixel> Format;
+    typedef typename Format::Value Value;
+    typedef typename Format::Storage Storage;
+private:
+    unsigned int height;
+    unsigned int width;
+    //длина строки в элементах хранения, кратная CANVAS_ALIGNMENT байт
+    unsigned int stride;
+    //все строки лежат подряд в одном буфере
+    vector<Storage, AlignedAllocator<Storage, CANVAS_ALIGNMENT>> canvas;
+    //текущий цвет, которым рисуют примитивы
+    Value ink;
+    //Учёт изменений: каждая плитка хранит поколение последней записи в неё.
+    //Потребители (clear, frame, вывод в терминал, экспорт) помнят поколение
+    //своего прошлого прохода и обрабатывают только более новые плитки
+    unsigned int tileRows;
+    unsigned int tileColumns;
+    vector<uint64_t> tileVersion;
+    mutable uint64_t generation;
+    //поколение последней очистки: более новые плитки содержат рисунок
+    uint64_t clearedAt;
+    string frameBuffer;
+    uint64_t frameSeen;
+    CanvasId canvasId;
+public:
+    BasicCanvas(unsigned int height, unsigned int width) {
+        this->height = height;
+        this->width = width;
+        if (height == 0 || width == 0)
+            throw runtime_error("zero size");
+        size_t rowBytes = (width + Format::PIXELS_PER_ELEMENT - 1) / Format::PIXELS_PER_ELEMENT * sizeof(Storage);
+        stride = (rowBytes + CANVAS_ALIGNMENT - 1) / CANVAS_ALIGNMENT * CANVAS_ALIGNMENT / sizeof(Storage);
+        canvas.resize((size_t)stride * height);
+        Format::fill(&canvas[0], 0, canvas.size() * Format::PIXELS_PER_ELEMENT, Format::background());
+        ink = Format::ink();
+        tileRows = (height + DIRTY_TILE_HEIGHT - 1) / DIRTY_TILE_HEIGHT;
+        tileColumns = (width + DIRTY_TILE_WIDTH - 1) / DIRTY_TILE_WIDTH;
+        //чистый холст: плитки новее нулевого поколения, но не новее очистки
+        tileVersion.assign((size_t)tileRows * tileColumns, 1);
+        clearedAt = 1;
+        generation = 2;
+        frameSeen = 0;
+    }
+    unsigned int getHeight() const {
+        return height;
+    }
+    unsigned int getWidth() const {
+        return width;
+    }
+    unsigned int getStride() const {
+        return stride;
+    }
+    //0 не выдаётся ни одному холсту
+    uint64_t id() const {
+        return canvasId.get();
+    }
+    //шаг строки в пикселях для линейного индекса
+    size_t pixelStride() const {
+        return (size_t)stride * Format::PIXELS_PER_ELEMENT;
+    }
+    Storage* row(unsigned int y) {
+        return &canvas[(size_t)y * stride];
+    }
+    const Storage* row(unsigned int y) const {
+        return &canvas[(size_t)y * stride];
+    }
+    Storage* data() {
+        return &canvas[0];
+    }
+    const Storage* data() const {
+        return &canvas[0];
+    }
+    Value getInk() const {
+        return ink;
+    }
+    void setInk(Value value) {
+        ink = value;
+    }
+    //Начало прохода потребителя изменений: возвращает поколение, которое
+    //потребитель запоминает; все последующие записи будут новее него
+    uint64_t advanceGeneration() const {
+        return generation++;
+    }
+    //Отмечает изменённым прямоугольник (границы включительно, внутри холста).
+    //Параллельные писатели должны отмечать разные строки плиток
+    void markDirty(int y_min, int x_min, int y_max, int x_max) {
+        unsigned int columnFirst = (unsigned int)x_min / DIRTY_TILE_WIDTH;
+        unsigned int columnLast = (unsigned int)x_max / DIRTY_TILE_WIDTH;
+        unsigned int tileRowLast = (unsigned int)y_max / DIRTY_TILE_HEIGHT;
+        for (unsigned int tileRow = (unsigned int)y_min / DIRTY_TILE_HEIGHT; tileRow <= tileRowLast; tileRow++) {
+            uint64_t* version = &tileVersion[(size_t)tileRow * tileColumns];
+            for (unsigned int column = columnFirst; column <= columnLast; column++)
+                version[column] = generation;
+        }
+    }
+    //То же с обрезкой по холсту
+    void markDirtyClipped(int y_min, int x_min, int y_max, int x_max) {
+        y_min = max(y_min, 0);
+        x_min = max(x_min, 0);
+        y_max = min(y_max, (int)height - 1);
+        x_max = min(x_max, (int)width - 1);
+        if (y_min <= y_max && x_min <= x_max)
+            markDirty(y_min, x_min, y_max, x_max);
+    }
+    void markPixel(int y, int x) {
+        tileVersion[(size_t)((unsigned int)y / DIRTY_TILE_HEIGHT) * tileColumns + (unsigned int)x / DIRTY_TILE_WIDTH] = generation;
+    }
+    //visit(y_min, x_min, y_max, x_max) для каждой серии соседних плиток строки,
+    //изменённых после поколения since; прямоугольники обрезаны по холсту
+    template <class Visitor>
+    void forEachChangedSpan(uint64_t since, Visitor visit) const {
+        for (unsigned int tileRow = 0; tileRow < tileRows; tileRow++) {
+            const uint64_t* version = &tileVersion[(size_t)tileRow * tileColumns];
+            int y_min = tileRow * DIRTY_TILE_HEIGHT;
+            int y_max = min(y_min + (int)DIRTY_TILE_HEIGHT, (int)height) - 1;
+            unsigned int column = 0;
+            while (column < tileColumns) {
+                if (version[column] <= since) {
+                    column++;
+                    continue;
+                }
+                unsigned int first = column;
+                while (column < tileColumns && version[column] > since)
+                    column++;
+                visit(y_min, (int)(first * DIRTY_TILE_WIDTH),
+                      y_max, min((int)(column * DIRTY_TILE_WIDTH), (int)width) - 1);
+            }
+        }
+    }
+    //Стирает только плитки, в которые рисовали после прошлой очистки
+    void clear() {
+        uint64_t now = advanceGeneration();
+        forEachChangedSpan(clearedAt, [&](int y_min, int x_min, int y_max, int x_max) {
+            for (int y = y_min; y <= y_max; y++)
+                Format::fill(&canvas[0], y * pixelStride() + x_min, x_max - x_min + 1, Format::background());
+            for (int tileRow = y_min / DIRTY_TILE_HEIGHT; tileRow <= y_max / (int)DIRTY_TILE_HEIGHT; tileRow++)
+                for (int column = x_min / DIRTY_TILE_WIDTH; column <= x_max / (int)DIRTY_TILE_WIDTH; column++)
+                    tileVersion[(size_t)tileRow * tileColumns + column] = now;
+        });
+        clearedAt = now;
+    }
+    //Запись по линейному индексу без проверки границ и без отметки изменений:
+    //вызывающий сам отмечает затронутые плитки
+    void store(size_t index, Value value) {
+        Format::store(&canvas[0], index, value);
+    }
+    void fillIndex(size_t index, size_t count, Value value) {
+        Format::fill(&canvas[0], index, count, value);
+    }
+    Value load(size_t index) const {
+        return Format::load(&canvas[0], index);
+    }
+    void setElement(int y, int x, Value element) {
+        if ( y < 0 || x < 0 || y >= (int)height || x >= (int)width)
+            throw runtime_error("out of range insertion");
+        store(y * pixelStride() + x, element);
+        markPixel(y, x);
+    }
+    Value getElement(int y, int x) const {
+        if ( y < 0 || x < 0 || y >= (int)height || x >= (int)width)
+            throw runtime_error("out of range access");
+        return load(y * pixelStride() + x);
+    }
+    bool contains(int y, int x) const {
+        return y >= 0 && x >= 0 && y < (int)height && x < (int)width;
+    }
+    //Отрезок строки без проверки границ, x_left <= x_right
+    void fillRow(int y, int x_left, int x_right, Value element) {
+        Format::fill(&canvas[0], y * pixelStride() + x_left, x_right - x_left + 1, element);
+        markDirty(y, x_left, y, x_right);
+    }
+    //Горизонтальный отрезок строки y от x_left до x_right включительно,
+    //обрезается по холсту
+    void fillSpan(int y, int x_left, int x_right, Value element) {
+        if (y < 0 || y >= (int)height)
+            return;
+        if (x_left < 0)
+            x_left = 0;
+        if (x_right >= (int)width)
+            x_right = width - 1;
+        if (x_left <= x_right)
+            fillRow(y, x_left, x_right, element);
+    }
+    //Прямоугольник rectHeight x rectWidth из точки (sourceY, sourceX) холста
+    //source накладывается в точку (y, x) операцией op. Прямоугольник
+    //обрезается по обоим холстам один раз, дальше строки идут целиком
+    void composite(const BasicCanvas& source, int sourceY, int sourceX, int rectHeight, int rectWidth,
+                   int y, int x, Composite op) {
+        if (sourceY < 0) {
+            y -= sourceY;
+            rectHeight += sourceY;
+            sourceY = 0;
+        }
+        if (sourceX < 0) {
+            x -= sourceX;
+            rectWidth += sourceX;
+            sourceX = 0;
+        }
+        if (y < 0) {
+            sourceY -= y;
+            rectHeight += y;
+            y = 0;
+        }
+        if (x < 0) {
+            sourceX -= x;
+            rectWidth += x;
+            x = 0;
+        }
+        rectHeight = min(rectHeight, min((int)source.getHeight() - sourceY, (int)height - y));
+        rectWidth = min(rectWidth, min((int)source.getWidth() - sourceX, (int)width - x));
+        if (rectHeight <= 0 || rectWidth <= 0)
+            return;
+        for (int row = 0; row < rectHeight; row++)
+            Format::composite(&canvas[0], (y + row) * pixelStride() + x,
+                              source.data(), (sourceY + row) * source.pixelStride() + sourceX,
+                              rectWidth, op, Format::background());
+        markDirty(y, x, y + rectHeight - 1, x + rectWidth - 1);
+    }
+    void composite(const BasicCanvas& source, int y, int x, Composite op) {
+        composite(source, 0, 0, source.getHeight(), source.getWidth(), y, x, op);
+    }
+    //Копирование холста того же формата в точку (y, x), с отсечением
+    void blit(const BasicCanvas& source, int y, int x) {
+        composite(source, y, x, Composite::Copy);
+    }
+    void blit(const BasicCanvas& source, int sourceY, int sourceX, int rectHeight, int rectWidth, int y, int x) {
+        composite(source, sourceY, sourceX, rectHeight, rectWidth, y, x, Composite::Copy);
+    }
+    //Спрайт: непустые ячейки ложатся поверх, ячейки фона прозрачны
+    void stamp(const BasicCanvas& sprite, int y, int x) {
+        composite(sprite, y, x, Composite::Or);
+    }
+    //Кадр с рамкой в одном буфере. Буфер собирается один раз,
+    //дальше в нём обновляются только изменившиеся плитки
+    const string& frame() {
+        uint64_t now = advanceGeneration();
+        if (frameBuffer.empty()) {
+            frameBuffer.reserve((size_t)(width + 3) * (height + 2));
+            frameBuffer.append(width, '-');
+            frameBuffer.push_back('\n');
+            for (unsigned int i = 0; i < height; i++) {
+                frameBuffer.push_back('|');
+                frameBuffer.append(row(i), width);
+                frameBuffer.append("|\n");
+            }
+            frameBuffer.append(width, '-');
+            frameBuffer.push_back('\n');
+        } else {
+            forEachChangedSpan(frameSeen, [&](int y_min, int x_min, int y_max, int x_max) {
+                //строка y начинается после верхней рамки и своего символа '|'
+                for (int y = y_min; y <= y_max; y++)
+                    memcpy(&frameBuffer[(width + 1) + (size_t)y * (width + 3) + 1 + x_min],
+                           row(y) + x_min, x_max - x_min + 1);
+            });
+        }
+        frameSeen = now;
+        return frameBuffer;
+    }
+    //Одна запись на каждый поток вывода
+    void print(ofstream& file) {
+        const string& text = frame();
+        std::cout.write(text.data(), text.size());
+        std::cout.flush();
+        if (file.is_open()) {
+            file.write(text.data(), text.size());
+            file.flush();
+        }
+    }
+};
+
+typedef BasicCanvas<char> Canvas;
+//8-битное покрытие ячеек (0 - пусто, 255 - полностью закрашено)
+typedef BasicCanvas<Gray8> CoverageCanvas;
+typedef BasicCanvas<Bit> BitCanvas;
+typedef BasicCanvas<RGBA32> ColorCanvas;
+
+//Шкала плотности для вывода покрытия символами, от пустого к полному
+const char COVERAGE_RAMP[] = " .:-=+*#%@";
+
+//Перевод покрытия в символы шкалы COVERAGE_RAMP на текстовом холсте того же размера
+void toAscii(const CoverageCanvas& coverage, Canvas& canvas) {
+    if (canvas.getHeight() != coverage.getHeight() || canvas.getWidth() != coverage.getWidth())
+        throw runtime_error("canvas size mismatch");
+    const int levels = sizeof(COVERAGE_RAMP) - 1;
+    char table[256];
+    for (int value = 0; value < 256; value++)
+        table[value] = COVERAGE_RAMP[(value * levels + 255) / 256 < levels ? (value * levels + 255) / 256 : levels - 1];
+    for (unsigned int y = 0; y < coverage.getHeight(); y++) {
+        const Gray8* source = coverage.row(y);
+        char* target = canvas.row(y);
+        for (unsigned int x = 0; x < coverage.getWidth(); x++)
+            target[x] = table[source[x]];
+    }
+    canvas.markDirty(0, 0, canvas.getHeight() - 1, canvas.getWidth() - 1);
+}
+
+//Двоичные PBM/PGM/PPM: заголовок и пиксели собираются в один буфер
+//и уходят в файл одной записью
+bool writeImageBuffer(const string& filename, const string& image) {
+    ofstream file(filename, std::ios::trunc | std::ios::binary);
+    if (!file.is_open())
+        return false;
+    file.write(image.data(), image.size());
+    return (bool)file;
+}
+
+string imageHeader(const char* magic, unsigned int width, unsigned int height, bool withMaxValue) {
+    char header[64];
+    int length = snprintf(header, sizeof(header), withMaxValue ? "%s\n%u %u\n255\n" : "%s\n%u %u\n",
+                          magic, width, height);
+    return string(header, length);
+}
+
+//Кодирование строки холста в двоичный формат: пиксели [x_min, x_max]
+//записываются в строку образа target
+template <class Pixel>
+struct ImageEncoding;
+
+template <>
+struct ImageEncoding<Bit> {
+    static const char* magic() { return "P4"; }
+    static bool withMaxValue() { return false; }
+    static size_t rowBytes(unsigned int width) { return (width + 7) / 8; }
+    //x_min - начало плитки, поэтому кратен 8
+    static void encode(const unsigned char* source, int x_min, int x_max, char* target) {
+        memcpy(target + x_min / 8, source + x_min / 8, x_max / 8 - x_min / 8 + 1);
+    }
+};
+
+template <>
+struct ImageEncoding<Gray8> {
+    static const char* magic() { return "P5"; }
+    static bool withMaxValue() { return true; }
+    static size_t rowBytes(unsigned int width) { return width; }
+    static void encode(const Gray8* source, int x_min, int x_max, char* target) {
+        memcpy(target + x_min, source + x_min, x_max - x_min + 1);
+    }
+};
+
+template <>
+struct ImageEncoding<RGBA32> {
+    static const char* magic() { return "P6"; }
+    static bool withMaxValue() { return true; }
+    static size_t rowBytes(unsigned int width) { return (size_t)width * 3; }
+    static void encode(const RGBA32* source, int x_min, int x_max, char* target) {
+        target += (size_t)x_min * 3;
+        for (int x = x_min; x <= x_max; x++) {
+            *target++ = source[x].r;
+            *target++ = source[x].g;
+            *target++ = source[x].b;
+        }
+    }
+};
+
+//Инкрементальный экспорт серии кадров: образ файла хранится между вызовами,
+//первый раз кодируется целиком, дальше - только изменившиеся плитки.
+//Для серии кадров один ImageWriter держат всё время экспорта
+template <class Pixel>
+class ImageWriter {
+private:
+    typedef ImageEncoding<Pixel> Encoding;
+    uint64_t source = 0;
+    uint64_t seen = 0;
+    size_t header = 0;
+    string image;
+public:
+    bool write(const BasicCanvas<Pixel>& canvas, const string& filename) {
+        uint64_t now = canvas.advanceGeneration();
+        size_t rowBytes = Encoding::rowBytes(canvas.getWidth());
+        if (canvas.id() != source) {
+            source = canvas.id();
+            image = imageHeader(Encoding::magic(), canvas.getWidth(), canvas.getHeight(), Encoding::withMaxValue());
+            header = image.size();
+            image.resize(header + rowBytes * canvas.getHeight());
+            seen = 0;
+        }
+        canvas.forEachChangedSpan(seen, [&](int y_min, int x_min, int y_max, int x_max) {
+            for (int y = y_min; y <= y_max; y++)
+                Encoding::encode(canvas.row(y), x_min, x_max, &image[header + y * rowBytes]);
+        });
+        seen = now;
+        return writeImageBuffer(filename, image);
+    }
+};
+
+//Разовый экспорт: кадр кодируется целиком, для серии кадров - ImageWriter
+bool writePBM(const BitCanvas& canvas, const string& filename) {
+    return ImageWriter<Bit>().write(canvas, filename);
+}
+
+bool writePGM(const CoverageCanvas& canvas, const string& filename) {
+    return ImageWriter<Gray8>().write(canvas, filename);
+}
+
+bool writePPM(const ColorCanvas& canvas, const string& filename) {
+    return ImageWriter<RGBA32>().write(canvas, filename);
+}
+
+//Холст из квадратных плиток 2^TileShift пикселей в отображённой в память
+//области (файл или анонимная память) - для изображений больше памяти.
+//Место под плитку выделяется при первой записи, до этого она читается
+//фоном. Места выдаются подряд в порядке первого касания, поэтому занятая
+//часть файла плотная, а каждая плитка - непрерывный блок строк.
+//Интерфейс совпадает с BasicCanvas в той части, которой пользуются
+//примитивы; шаг строки - степень двойки, индекс разбирается сдвигами
+template <class Pixel, unsigned int TileShift = 8>
+class BasicTiledCanvas {
+public:
+    typedef PixelFormat<Pixel> Format;
+    typedef typename Format::Value Value;
+    typedef typename Format::Storage Storage;
+    static const unsigned int TILE = 1u << TileShift;
+private:
+    static const uint32_t NO_SLOT = 0xFFFFFFFF;
+    static const size_t TILE_BYTES = (size_t)TILE * TILE / Format::PIXELS_PER_ELEMENT * sizeof(Storage);
+    unsigned int height;
+    unsigned int width;
+    unsigned int strideShift;
+    unsigned int tileColumns;
+    size_t tileCount;
+    //номер места каждой плитки или NO_SLOT
+    unique_ptr<atomic<uint32_t>[]> directory;
+    mutex allocation;
+    uint32_t usedSlots = 0;
+    //места, под которые файл уже увеличен
+    size_t fileSlots = 0;
+    int fd = -1;
+    char* base = nullptr;
+    size_t mappedBytes;
+    Value ink;
+    size_t localIndex(size_t y, size_t x) const {
+        return ((y & (TILE - 1)) << TileShift) | (x & (TILE - 1));
+    }
+    size_t tileOf(size_t y, size_t x) const {
+        return (y >> TileShift) * tileColumns + (x >> TileShift);
+    }
+    Storage* slotData(uint32_t slot) const {
+        return reinterpret_cast<Storage*>(base + slot * TILE_BYTES);
+    }
+    //Первая запись в плитку: место выдаётся под блокировкой, поэтому
+    //примитивы могут писать в разные полосы параллельно
+    uint32_t allocateTile(size_t tile) {
+        lock_guard<mutex> lock(allocation);
+        uint32_t slot = directory[tile].load(memory_order_relaxed);
+        if (slot != NO_SLOT)
+            return slot;
+        slot = usedSlots++;
+        if (fd >= 0 && slot >= fileSlots) {
+            fileSlots = min(max(fileSlots * 2, (size_t)slot + 1), tileCount);
+            if (ftruncate(fd, fileSlots * TILE_BYTES) != 0)
+                throw runtime_error("cannot grow tile file");
+        }
+        Format::fill(slotData(slot), 0, (size_t)TILE * TILE, Format::background());
+        directory[tile].store(slot, memory_order_release);
+        return slot;
+    }
+    Storage* writableTile(size_t y, size_t x) {
+        size_t tile = tileOf(y, x);
+        uint32_t slot = directory[tile].load(memory_order_acquire);
+        if (slot == NO_SLOT)
+            slot = allocateTile(tile);
+        return slotData(slot);
+    }
+public:
+    //path - файл для плиток; пустой путь - анонимная память
+    BasicTiledCanvas(unsigned int height, unsigned int width, const string& path = "") {
+        this->height = height;
+        this->width = width;
+        if (height == 0 || width == 0)
+            throw runtime_error("zero size");
+        strideShift = TileShift;
+        while ((1ULL << strideShift) < width)
+            strideShift++;
+        tileColumns = (width + TILE - 1) / TILE;
+        tileCount = (size_t)tileColumns * ((height + TILE - 1) / TILE);
+        if (tileCount >= NO_SLOT)
+            throw runtime_error("too many tiles");
+        directory.reset(new atomic<uint32_t>[tileCount]);
+        for (size_t i = 0; i < tileCount; i++)
+            directory[i].store(NO_SLOT, memory_order_relaxed);
+        mappedBytes = tileCount * TILE_BYTES;
+        void* memory;
+        if (path.empty()) {
+            memory = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        } else {
+            fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw runtime_error("cannot open tile file");
+            //отображается весь возможный размер, файл растёт по мере выдачи мест
+            memory = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (memory == MAP_FAILED) {
+            if (fd >= 0)
+                close(fd);
+            throw runtime_error("cannot map tile storage");
+        }
+        base = static_cast<char*>(memory);
+        ink = Format::ink();
+    }
+    BasicTiledCanvas(const BasicTiledCanvas&) = delete;
+    BasicTiledCanvas& operator=(const BasicTiledCanvas&) = delete;
+    ~BasicTiledCanvas() {
+        munmap(base, mappedBytes);
+        if (fd >= 0)
+            close(fd);
+    }
+    unsigned int getHeight() const {
+        return height;
+    }
+    unsigned int getWidth() const {
+        return width;
+    }
+    size_t pixelStride() const {
+        return (size_t)1 << strideShift;
+    }
+    //число плиток, под которые выделено место
+    size_t allocatedTiles() const {
+        return usedSlots;
+    }
+    Value getInk() const {
+        return ink;
+    }
+    void setInk(Value value) {
+        ink = value;
+    }
+    //Все плитки возвращаются в нечитанное состояние, их память и место
+    //в файле освобождаются; стоимость не зависит от размера холста
+    void clear() {
+        lock_guard<mutex> lock(allocation);
+        for (size_t i = 0; i < tileCount; i++)
+            directory[i].store(NO_SLOT, memory_order_relaxed);
+        if (fd >= 0) {
+            if (ftruncate(fd, 0) != 0)
+                throw runtime_error("cannot truncate tile file");
+            fileSlots = 0;
+        } else if (usedSlots > 0) {
+            madvise(base, usedSlots * TILE_BYTES, MADV_DONTNEED);
+        }
+        usedSlots = 0;
+    }
+    //clear() сбрасывает плитки целиком, отметки изменений не нужны
+    void markDirty(int, int, int, int) {}
+    void markDirtyClipped(int, int, int, int) {}
+    void markPixel(int, int) {}
+    void store(size_t index, Value value) {
+        size_t y = index >> strideShift;
+        size_t x = index & (pixelStride() - 1);
+        Format::store(writableTile(y, x), localIndex(y, x), value);
+    }
+    Value load(size_t index) const {
+        size_t y = index >> strideShift;
+        size_t x = index & (pixelStride() - 1);
+        uint32_t slot = directory[tileOf(y, x)].load(memory_order_acquire);
+        if (slot == NO_SLOT)
+            return Format::background();
+        return Format::load(slotData(slot), localIndex(y, x));
+    }
+    //Заливка внутри одной строки, режется по границам плиток
+    void fillIndex(size_t index, size_t count, Value value) {
+        size_t y = index >> strideShift;
+        size_t x = index & (pixelStride() - 1);
+        while (count > 0) {
+            size_t length = min(count, (size_t)TILE - (x & (TILE - 1)));
+            Format::fill(writableTile(y, x), localIndex(y, x), length, value);
+            x += length;
+            count -= length;
+        }
+    }
+    void setElement(int y, int x, Value element) {
+        if ( y < 0 || x < 0 || y >= (int)height || x >= (int)width)
+            throw runtime_error("out of range insertion");
+        store(((size_t)y << strideShift) + x, element);
+    }
+    Value getElement(int y, int x) const {
+        if ( y < 0 || x < 0 || y >= (int)height || x >= (int)width)
+            throw runtime_error("out of range access");
+        return load(((size_t)y << strideShift) + x);
+    }
+    bool contains(int y, int x) const {
+        return y >= 0 && x >= 0 && y < (int)height && x < (int)width;
+    }
+    void fillRow(int y, int x_left, int x_right, Value element) {
+        fillIndex(((size_t)y << strideShift) + x_left, x_right - x_left + 1, element);
+    }
+    void fillSpan(int y, int x_left, int x_right, Value element) {
+        if (y < 0 || y >= (int)height)
+            return;
+        if (x_left < 0)
+            x_left = 0;
+        if (x_right >= (int)width)
+            x_right = width - 1;
+        if (x_left <= x_right)
+            fillRow(y, x_left, x_right, element);
+    }
+};
+
+typedef BasicTiledCanvas<char> TiledCanvas;
+
+//Вывод в терминал только изменившихся ячеек: первый кадр печатается целиком,
+//дальше для каждой серии изменений - ANSI-позиционирование курсора и новые символы.
+//Сравниваются только плитки холста, изменённые после прошлого вывода
+class TerminalView {
+private:
+    uint64_t shown = 0;
+    uint64_t seen = 0;
+    unsigned int height = 0;
+    unsigned int width = 0;
+    vector<char> previous;
+    string output;
+    //серии, разделённые меньшим числом одинаковых ячеек, выгоднее склеить,
+    //чем заново позиционировать курсор
+    static const unsigned int MERGE_GAP = 8;
+    void moveCursor(unsigned int row, unsigned int column) {
+        char sequence[32];
+        int length = snprintf(sequence, sizeof(sequence), "\x1b[%u;%uH", row, column);
+        output.append(sequence, length);
+    }
+    void redraw(Canvas& canvas) {
+        height = canvas.getHeight();
+        width = canvas.getWidth();
+        previous.resize((size_t)width * height);
+        for (unsigned int y = 0; y < height; y++)
+            memcpy(&previous[(size_t)y * width], canvas.row(y), width);
+        output.append("\x1b[2J\x1b[H");
+        output.append(canvas.frame());
+    }
+    //Изменившиеся ячейки строки y в столбцах [x, limit)
+    void presentRow(const char* current, char* old, unsigned int y, unsigned int x, unsigned int limit) {
+        while (x < limit) {
+            if (current[x] == old[x]) {
+                x++;
+                continue;
+            }
+            unsigned int start = x;
+            unsigned int end = x + 1;
+            unsigned int same = 0;
+            for (x = end; x < limit && same < MERGE_GAP; x++) {
+                if (current[x] != old[x]) {
+                    end = x + 1;
+                    same = 0;
+                } else {
+                    same++;
+                }
+            }
+            //строка 1 и столбец 1 заняты рамкой
+            moveCursor(y + 2, start + 2);
+            output.append(current + start, end - start);
+            memcpy(old + start, current + start, end - start);
+            x = end;
+        }
+    }
+public:
+    void reset() {
+        shown = 0;
+        height = 0;
+        width = 0;
+        previous.clear();
+    }
+    void present(Canvas& canvas) {
+        output.clear();
+        uint64_t now = canvas.advanceGeneration();
+        if (canvas.id() != shown || canvas.getHeight() != height || canvas.getWidth() != width) {
+            shown = canvas.id();
+            redraw(canvas);
+        } else {
+            canvas.forEachChangedSpan(seen, [&](int y_min, int x_min, int y_max, int x_max) {
+                for (int y = y_min; y <= y_max; y++)
+                    presentRow(canvas.row(y), &previous[(size_t)y * width], y, x_min, x_max + 1);
+            });
+        }
+        seen = now;
+        moveCursor(height + 3, 1);
+        output.append("\x1b[K");
+        std::cout.write(output.data(), output.size());
+        std::cout.flush();
+    }
+};
+
+//Поток кадров через кольцо в разделяемой памяти (shm_open + mmap): другой
+//процесс читает кадры прямо из отображения, без файлов и промежуточных копий.
+//Раскладка: заголовок кольца, затем slots ячеек; ячейка - счётчик и строки
+//холста с шагом stride байт. Кадр n (с единицы) пишется в ячейку n % slots,
+//счётчик ячейки равен 2n-1, пока кадр пишется, и 2n после публикации.
+//Читатель сверяет счётчик до и после чтения и так узнаёт, что ячейку
+//не перезаписали у него на глазах
+const uint32_t FRAME_RING_MAGIC = 0x52464C5A;
+const uint32_t FRAME_RING_VERSION = 1;
+const unsigned int FRAME_RING_SLOTS = 4;
+const char FRAME_RING_NAME[] = "/zeroLab";
+
+struct FrameRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t height;
+    uint32_t width;
+    uint32_t stride;
+    uint32_t slots;
+    uint64_t slotBytes;
+    //номер последнего опубликованного кадра, 0 - кадров ещё не было
+    atomic<uint64_t> published;
+    const atomic<uint64_t>& sequence(unsigned int slot) const {
+        return *reinterpret_cast<const atomic<uint64_t>*>(slotAt(slot));
+    }
+    atomic<uint64_t>& sequence(unsigned int slot) {
+        return *reinterpret_cast<atomic<uint64_t>*>(slotAt(slot));
+    }
+    //пиксели начинаются с выровненного адреса после счётчика
+    const char* pixels(unsigned int slot) const {
+        return slotAt(slot) + CANVAS_ALIGNMENT;
+    }
+    char* pixels(unsigned int slot) {
+        return slotAt(slot) + CANVAS_ALIGNMENT;
+    }
+    static size_t totalBytes(unsigned int slots, size_t slotBytes) {
+        return CANVAS_ALIGNMENT + slots * slotBytes;
+    }
+private:
+    const char* slotAt(unsigned int slot) const {
+        return reinterpret_cast<const char*>(this) + CANVAS_ALIGNMENT + slot * slotBytes;
+    }
+    char* slotAt(unsigned int slot) {
+        return reinterpret_cast<char*>(this) + CANVAS_ALIGNMENT + slot * slotBytes;
+    }
+};
+static_assert(sizeof(FrameRingHeader) <= CANVAS_ALIGNMENT, "frame ring header must fit one line");
+
+//Писатель кольца. Ячейка помнит поколение холста, с которого она снята,
+//поэтому при публикации в неё копируются только плитки, изменённые позже.
+//Холст узнаётся по номеру: другой холст копируется в ячейки целиком
+class FrameRing {
+private:
+    string name;
+    int fd = -1;
+    size_t bytes = 0;
+    FrameRingHeader* header = nullptr;
+    uint64_t source = 0;
+    vector<uint64_t> slotSeen;
+public:
+    FrameRing(const string& name, const Canvas& canvas, unsigned int slots = FRAME_RING_SLOTS) {
+        this->name = name;
+        if (slots == 0)
+            throw runtime_error("zero slots");
+        //прежнее кольцо с тем же именем остаётся у уже подключённых читателей
+        shm_unlink(name.c_str());
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0)
+            throw runtime_error("cannot create frame ring");
+        size_t pixelBytes = (size_t)canvas.getStride() * canvas.getHeight();
+        size_t slotBytes = CANVAS_ALIGNMENT + (pixelBytes + CANVAS_ALIGNMENT - 1) / CANVAS_ALIGNMENT * CANVAS_ALIGNMENT;
+        bytes = FrameRingHeader::totalBytes(slots, slotBytes);
+        void* memory = MAP_FAILED;
+        if (ftruncate(fd, bytes) == 0)
+            memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw runtime_error("cannot map frame ring");
+        }
+        //после ftruncate память обнулена: счётчики ячеек и published равны 0
+        header = static_cast<FrameRingHeader*>(memory);
+        header->version = FRAME_RING_VERSION;
+        header->height = canvas.getHeight();
+        header->width = canvas.getWidth();
+        header->stride = canvas.getStride();
+        header->slots = slots;
+        header->slotBytes = slotBytes;
+        atomic_thread_fence(memory_order_release);
+        //признак готовности заголовка пишется последним
+        header->magic = FRAME_RING_MAGIC;
+        slotSeen.assign(slots, 0);
+    }
+    FrameRing(const FrameRing&) = delete;
+    FrameRing& operator=(const FrameRing&) = delete;
+    ~FrameRing() {
+        munmap(header, bytes);
+        close(fd);
+        shm_unlink(name.c_str());
+    }
+    const FrameRingHeader& info() const {
+        return *header;
+    }
+    //Публикует текущее содержимое холста, возвращает номер кадра
+    uint64_t publish(const Canvas& canvas) {
+        if (canvas.getHeight() != header->height || canvas.getWidth() != header->width)
+            throw runtime_error("canvas size mismatch");
+        if (canvas.id() != source) {
+            source = canvas.id();
+            slotSeen.assign(header->slots, 0);
+        }
+        uint64_t number = header->published.load(memory_order_relaxed) + 1;
+        unsigned int slot = number % header->slots;
+        atomic<uint64_t>& sequence = header->sequence(slot);
+        char* pixels = header->pixels(slot);
+        uint64_t now = canvas.advanceGeneration();
+        sequence.store(2 * number - 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        canvas.forEachChangedSpan(slotSeen[slot], [&](int y_min, int x_min, int y_max, int x_max) {
+            for (int y = y_min; y <= y_max; y++)
+                memcpy(pixels + (size_t)y * header->stride + x_min, canvas.row(y) + x_min, x_max - x_min + 1);
+        });
+        sequence.store(2 * number, memory_order_release);
+        header->published.store(number, memory_order_release);
+        slotSeen[slot] = now;
+        return number;
+    }
+};
+
+//Читатель кольца: только чтение, кадры разбираются прямо в отображении
+class FrameRingReader {
+private:
+    int fd = -1;
+    size_t bytes = 0;
+    const FrameRingHeader* header = nullptr;
+public:
+    FrameRingReader() {}
+    FrameRingReader(const FrameRingReader&) = delete;
+    FrameRingReader& operator=(const FrameRingReader&) = delete;
+    ~FrameRingReader() {
+        if (header != nullptr)
+            munmap(const_cast<FrameRingHeader*>(header), bytes);
+        if (fd >= 0)
+            close(fd);
+    }
+    //false, если кольца ещё нет или его заголовок не готов
+    bool open(const string& name) {
+        if (header != nullptr)
+            return true;
+        if (fd < 0)
+            fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            return false;
+        struct stat status;
+        if (fstat(fd, &status) != 0 || (size_t)status.st_size < CANVAS_ALIGNMENT)
+            return false;
+        void* memory = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (memory == MAP_FAILED)
+            return false;
+        const FrameRingHeader* candidate = static_cast<const FrameRingHeader*>(memory);
+        bool ready = candidate->magic == FRAME_RING_MAGIC;
+        atomic_thread_fence(memory_order_acquire);
+        if (ready && candidate->version != FRAME_RING_VERSION)
+            throw runtime_error("unsupported frame ring version");
+        if (!ready || FrameRingHeader::totalBytes(candidate->slots, candidate->slotBytes) != (size_t)status.st_size) {
+            munmap(memory, status.st_size);
+            return false;
+        }
+        header = candidate;
+        bytes = status.st_size;
+        return true;
+    }
+    const FrameRingHeader& info() const {
+        return *header;
+    }
+    uint64_t published() const {
+        return header->published.load(memory_order_acquire);
+    }
+    //visit(pixels) для кадра number прямо в ячейке кольца; false, если кадра
+    //в ячейке уже нет или писатель перезаписал его во время чтения -
+    //тогда прочитанное надо выбросить
+    template <class Visitor>
+    bool read(uint64_t number, Visitor visit) const {
+        unsigned int slot = number % header->slots;
+        const atomic<uint64_t>& sequence = header->sequence(slot);
+        if (number == 0 || sequence.load(memory_order_acquire) != 2 * number)
+            return false;
+        visit(header->pixels(slot));
+        atomic_thread_fence(memory_order_acquire);
+        return sequence.load(memory_order_relaxed) == 2 * number;
+    }
+};
+
+//Прямоугольник отсечения, границы включительно
+struct ClipRect {
+    int x_min, y_min;
+    int x_max, y_max;
+};
+
+template <class C>
+ClipRect canvasRect(const C& canvas) {
+    ClipRect rect = {0, 0, (int)canvas.getWidth() - 1, (int)canvas.getHeight() - 1};
+    return rect;
+}
+
+long long ceilDiv(long long a, long long b) {
+    return a >= 0 ? (a + b - 1) / b : -((-a) / b);
+}
+
+//Отрезок в параметрической форме: на шаге i по главной оси
+//смещение по второй оси равно (2*i*d_minor + d_major) / (2*d_major).
+//first..last - видимые шаги после отсечения
+struct LineClip {
+    int x_start, y_start;
+    int stepX, stepY;
+    int d_major, d_minor;
+    bool xMajor;
+    int first, last;
+    int minorOffset(int i) const {
+        //концы отрезка - без деления
+        if (i == 0)
+            return 0;
+        if (i == d_major)
+            return d_minor;
+        return (int)((2LL * i * d_minor + d_major) / (2LL * d_major));
+    }
+    //последний шаг, на котором смещение по второй оси ещё равно m
+    int lastStepOfRun(int m) const {
+        if (d_minor == 0)
+            return last;
+        return (int)ceilDiv(2LL * d_major * (m + 1) - d_major, 2LL * d_minor) - 1;
+    }
+};
+
+//Диапазон шагов i (0 <= i <= n), при которых start + step*i лежит в [lo, hi]
+bool clipAxis(int start, int step, int n, int lo, int hi, int& first, int& last) {
+    long long a, b;
+    if (step > 0) {
+        a = (long long)lo - start;
+        b = (long long)hi - start;
+    } else {
+        a = (long long)start - hi;
+        b = (long long)start - lo;
+    }
+    if (a < 0) a = 0;
+    if (b > n) b = n;
+    if (a > b)
+        return false;
+    first = (int)a;
+    last = (int)b;
+    return true;
+}
+
+//Параметры отрезка без отсечения: видны все шаги
+void setupLine(int y_start, int x_start, int y_end, int x_end, LineClip& clip) {
+    int dx = abs(x_end - x_start);
+    int dy = abs(y_end - y_start);
+    clip.x_start = x_start;
+    clip.y_start = y_start;
+    clip.stepX = (x_start < x_end) ? 1 : -1;
+    clip.stepY = (y_start < y_end) ? 1 : -1;
+    clip.xMajor = dx >= dy;
+    clip.d_major = clip.xMajor ? dx : dy;
+    clip.d_minor = clip.xMajor ? dy : dx;
+    clip.first = 0;
+    clip.last = clip.d_major;
+}
+
+//Отсечение отрезка прямоугольником один раз до растеризации
+bool clipLine(const ClipRect& rect, int y_start, int x_start, int y_end, int x_end, LineClip& clip) {
+    setupLine(y_start, x_start, y_end, x_end, clip);
+    int majorStart = clip.xMajor ? x_start : y_start;
+    int minorStart = clip.xMajor ? y_start : x_start;
+    int majorStep = clip.xMajor ? clip.stepX : clip.stepY;
+    int minorStep = clip.xMajor ? clip.stepY : clip.stepX;
+    int majorLo = clip.xMajor ? rect.x_min : rect.y_min;
+    int majorHi = clip.xMajor ? rect.x_max : rect.y_max;
+    int minorLo = clip.xMajor ? rect.y_min : rect.x_min;
+    int minorHi = clip.xMajor ? rect.y_max : rect.x_max;
+    if (!clipAxis(majorStart, majorStep, clip.d_major, majorLo, majorHi, clip.first, clip.last))
+        return false;
+    int mFirst, mLast;
+    if (!clipAxis(minorStart, minorStep, clip.d_minor, minorLo, minorHi, mFirst, mLast))
+        return false;
+    if (clip.d_minor > 0) {
+        if (mFirst > 0) {
+            int i = (int)ceilDiv(2LL * clip.d_major * mFirst - clip.d_major, 2LL * clip.d_minor);
+            if (i > clip.first) clip.first = i;
+        }
+        if (mLast < clip.d_minor) {
+            int i = clip.lastStepOfRun(mLast);
+            if (i < clip.last) clip.last = i;
+        }
+    }
+    return clip.first <= clip.last;
+}
+
+//Отметка изменённых плиток вдоль отсечённого отрезка. Отрезок режется на
+//куски по границам плиток вдоль главной оси: кусок лежит в одном столбце
+//(строке) плиток и задевает все плитки между смещениями своих концов,
+//поэтому отметка точная и не выходит за прямоугольник отсечения.
+//Смещения концов кусков ведутся частным и остатком, без деления на кусок
+template <class C>
+void markClippedLine(C& canvas, const LineClip& clip) {
+    //кусок от шага i со смещением m_i до шага j со смещением m_j
+    auto markChunk = [&](int i, int m_i, int j, int m_j) {
+        int x_first = clip.x_start + clip.stepX * (clip.xMajor ? i : m_i);
+        int y_first = clip.y_start + clip.stepY * (clip.xMajor ? m_i : i);
+        int x_last = clip.x_start + clip.stepX * (clip.xMajor ? j : m_j);
+        int y_last = clip.y_start + clip.stepY * (clip.xMajor ? m_j : j);
+        canvas.markDirty(min(y_first, y_last), min(x_first, x_last), max(y_first, y_last), max(x_first, x_last));
+    };
+    int extent = clip.xMajor ? DIRTY_TILE_WIDTH : DIRTY_TILE_HEIGHT;
+    int majorStart = clip.xMajor ? clip.x_start : clip.y_start;
+    int majorStep = clip.xMajor ? clip.stepX : clip.stepY;
+    //первый кусок - до границы плитки, дальше куски по extent шагов
+    int coordinate = majorStart + majorStep * clip.first;
+    int tileBase = coordinate / extent * extent;
+    int j = clip.first + (majorStep > 0 ? tileBase + extent - 1 - coordinate : coordinate - tileBase);
+    int i = clip.first;
+    int m_head = clip.minorOffset(i);
+    if (j >= clip.last) {
+        markChunk(i, m_head, clip.last, clip.minorOffset(clip.last));
+        return;
+    }
+    long long denominator = 2LL * clip.d_major;
+    long long step = 2LL * extent * clip.d_minor;
+    long long stepQuotient = step / denominator;
+    long long stepRemainder = step % denominator;
+    //смещение по второй оси: (2*i*d_minor + d_major) / (2*d_major)
+    long long tailNumerator = 2LL * j * clip.d_minor + clip.d_major;
+    long long m_tail = tailNumerator / denominator;
+    long long tailRemainder = tailNumerator % denominator;
+    while (j < clip.last) {
+        markChunk(i, m_head, j, (int)m_tail);
+        //следующий шаг после конца куска смещается не больше чем на 1
+        m_head = (int)m_tail + (tailRemainder + 2LL * clip.d_minor >= denominator ? 1 : 0);
+        i = j + 1;
+        j += extent;
+        m_tail += stepQuotient;
+        tailRemainder += stepRemainder;
+        if (tailRemainder >= denominator) {
+            tailRemainder -= denominator;
+            m_tail++;
+        }
+    }
+    markChunk(i, m_head, clip.last, clip.minorOffset(clip.last));
+}
+
+template <class C>
+void drawClippedLine(C& canvas, const LineClip& clip) {
+    markClippedLine(canvas, clip);
+    int m = clip.minorOffset(clip.first);
+    int x = clip.x_start + clip.stepX * (clip.xMajor ? clip.first : m);
+    int y = clip.y_start + clip.stepY * (clip.xMajor ? m : clip.first);
+    long long stride = canvas.pixelStride();
+    long long pixel = y * stride + x;
+    typename C::Value ink = canvas.getInk();
+    //шаги по главной и второй оси в линейных индексах пикселей
+    long long majorStep = clip.xMajor ? clip.stepX : clip.stepY * stride;
+    long long minorStep = clip.xMajor ? clip.stepY * stride : clip.stepX;
+    //целочисленная ошибка: 2*i*d_minor - 2*m*d_major, всегда в [-d_major, d_major)
+    long long error = 2LL * clip.first * clip.d_minor - 2LL * m * clip.d_major;
+    long long delta_error = 2LL * clip.d_minor;
+    long long correction = 2LL * clip.d_major;
+    canvas.store(pixel, ink);
+    for (int i = clip.first + 1; i <= clip.last; i++) {
+        pixel += majorStep;
+        error += delta_error;
+        if (error >= clip.d_major) {
+            error -= correction;
+            pixel += minorStep;
+        }
+        canvas.store(pixel, ink);
+    }
+}
+
+template <class C>
+void brezenchemAlgorithm(C& canvas, int y_start, int x_start, int y_end, int x_end) {
+    LineClip clip;
+    if (clipLine(canvasRect(canvas), y_start, x_start, y_end, x_end, clip))
+        drawClippedLine(canvas, clip);
+}
+
+//Растеризация сериями: для каждой строки (столбца) длина серии вычисляется
+//заранее, горизонтальная серия записывается одной заливкой строки.
+//Пиксели совпадают с brezenchemAlgorithm
+template <class C>
+void drawClippedRuns(C& canvas, const LineClip& clip) {
+    markClippedLine(canvas, clip);
+    long long stride = canvas.pixelStride();
+    typename C::Value ink = canvas.getInk();
+    int i = clip.first;
+    int m = clip.minorOffset(i);
+    //конец серии: ceil((2*d_major*(m+1) - d_major) / (2*d_minor)) - 1,
+    //числитель растёт на 2*d_major за серию, частное ведём без деления
+    int runEnd = clip.lastStepOfRun(m);
+    long long denominator = 2LL * clip.d_minor;
+    long long runQuotient = 0, runRemainder = 0, remainder = 0;
+    if (clip.d_minor > 0) {
+        long long numerator = 2LL * clip.d_major * (m + 1) - clip.d_major;
+        remainder = (long long)(runEnd + 1) * denominator - numerator;
+        runQuotient = clip.d_major / clip.d_minor;
+        runRemainder = 2LL * clip.d_major - runQuotient * denominator;
+    }
+    while (i <= clip.last) {
+        int last = runEnd < clip.last ? runEnd : clip.last;
+        int length = last - i + 1;
+        if (clip.xMajor) {
+            int y = clip.y_start + clip.stepY * m;
+            int x = clip.x_start + clip.stepX * (clip.stepX > 0 ? i : last);
+            canvas.fillIndex(y * stride + x, length, ink);
+        } else {
+            int x = clip.x_start + clip.stepX * m;
+            int y = clip.y_start + clip.stepY * (clip.stepY > 0 ? i : last);
+            long long pixel = y * stride + x;
+            for (int k = 0; k < length; k++, pixel += stride)
+                canvas.store(pixel, ink);
+        }
+        i = last + 1;
+        m++;
+        remainder -= runRemainder;
+        if (remainder < 0) {
+            remainder += denominator;
+            runEnd += (int)runQuotient + 1;
+        } else {
+            runEnd += (int)runQuotient;
+        }
+    }
+}
+
+template <class C>
+void runSliceAlgorithm(C& canvas, int y_start, int x_start, int y_end, int x_end) {
+    LineClip clip;
+    if (clipLine(canvasRect(canvas), y_start, x_start, y_end, x_end, clip))
+        drawClippedRuns(canvas, clip);
+}
+
+struct Segment {
+    int y_start, x_start;
+    int y_end, x_end;
+};
+
+//Пул потоков: parallelFor раздаёт индексы задач через атомарный счётчик,
+//вызывающий поток тоже участвует в работе
+class ThreadPool {
+private:
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+    const function<void(unsigned int)>* task = nullptr;
+    unsigned int taskCount = 0;
+    atomic<unsigned int> nextTask;
+    unsigned int busy = 0;
+    unsigned int generation = 0;
+    bool stopping = false;
+    void runTasks() {
+        unsigned int i;
+        while ((i = nextTask.fetch_add(1)) < taskCount)
+            (*task)(i);
+    }
+    void workerLoop() {
+        unsigned int seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+            runTasks();
+            lock_guard<mutex> guard(lock);
+            if (--busy == 0)
+                done.notify_one();
+        }
+    }
+public:
+    explicit ThreadPool(unsigned int threads = thread::hardware_concurrency()) : nextTask(0) {
+        for (unsigned int i = 1; i < threads; i++)
+            workers.push_back(thread(&ThreadPool::workerLoop, this));
+    }
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    unsigned int size() const {
+        return workers.size() + 1;
+    }
+    void parallelFor(unsigned int count, const function<void(unsigned int)>& fn) {
+        if (workers.empty() || count <= 1) {
+            for (unsigned int i = 0; i < count; i++)
+                fn(i);
+            return;
+        }
+        {
+            lock_guard<mutex> guard(lock);
+            task = &fn;
+            taskCount = count;
+            nextTask = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        runTasks();
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [&] { return busy == 0; });
+    }
+};
+
+ThreadPool& defaultThreadPool() {
+    static ThreadPool pool;
+    return pool;
+}
+
+//высота полосы строк, которую целиком растеризует один поток
+const int TILE_ROWS = 32;
+//меньший пакет дешевле нарисовать подряд, чем раскладывать по полосам
+const size_t LINES_SERIAL_BATCH = 64;
+
+//Пакетная отрисовка отрезков: отрезки раскладываются по горизонтальным
+//полосам холста, полосы растеризуются параллельно. Каждая полоса пишет
+//только в свои строки, поэтому блокировки не нужны, а внутри полосы
+//отрезки рисуются в порядке поступления. С одним потоком или на малом
+//пакете раскладка только мешает: отрезки рисуются подряд по всему холсту
+template <class C>
+void drawLines(C& canvas, const Segment* segments, size_t count, ThreadPool& pool) {
+    ClipRect rect = canvasRect(canvas);
+    if (pool.size() == 1 || count < LINES_SERIAL_BATCH) {
+        LineClip clip;
+        for (size_t i = 0; i < count; i++)
+            if (clipLine(rect, segments[i].y_start, segments[i].x_start, segments[i].y_end, segments[i].x_end, clip))
+                drawClippedRuns(canvas, clip);
+        return;
+    }
+    int height = canvas.getHeight();
+    unsigned int tiles = (height + TILE_ROWS - 1) / TILE_ROWS;
+    vector<unsigned int> tileStart(tiles + 1, 0);
+    for (size_t i = 0; i < count; i++) {
+        int y_min = min(segments[i].y_start, segments[i].y_end);
+        int y_max = max(segments[i].y_start, segments[i].y_end);
+        if (y_max < 0 || y_min >= height)
+            continue;
+        int first = max(y_min, 0) / TILE_ROWS;
+        int last = min(y_max, height - 1) / TILE_ROWS;
+        for (int t = first; t <= last; t++)
+            tileStart[t + 1]++;
+    }
+    for (unsigned int t = 0; t < tiles; t++)
+        tileStart[t + 1] += tileStart[t];
+    vector<unsigned int> bins(tileStart[tiles]);
+    vector<unsigned int> fill(tileStart.begin(), tileStart.end() - 1);
+    for (size_t i = 0; i < count; i++) {
+        int y_min = min(segments[i].y_start, segments[i].y_end);
+        int y_max = max(segments[i].y_start, segments[i].y_end);
+        if (y_max < 0 || y_min >= height)
+            continue;
+        int first = max(y_min, 0) / TILE_ROWS;
+        int last = min(y_max, height - 1) / TILE_ROWS;
+        for (int t = first; t <= last; t++)
+            bins[fill[t]++] = i;
+    }
+    pool.parallelFor(tiles, [&](unsigned int t) {
+        ClipRect tile = rect;
+        tile.y_min = t * TILE_ROWS;
+        tile.y_max = min(tile.y_min + TILE_ROWS - 1, rect.y_max);
+        LineClip clip;
+        for (unsigned int k = tileStart[t]; k < tileStart[t + 1]; k++) {
+            const Segment& segment = segments[bins[k]];
+            if (clipLine(tile, segment.y_start, segment.x_start, segment.y_end, segment.x_end, clip))
+                drawClippedRuns(canvas, clip);
+        }
+    });
+}
+
+template <class C>
+void drawLines(C& canvas, const vector<Segment>& segments) {
+    if (!segments.empty())
+        drawLines(canvas, &segments[0], segments.size(), defaultThreadPool());
+}
+
+template <class C>
+void plotClipped(C& canvas, int y, int x) {
+    if (canvas.contains(y, x))
+        canvas.store(y * canvas.pixelStride() + x, canvas.getInk());
+}
+
+//Отметка изменённых плиток для фигур, симметричных относительно центра.
+//Точки первой четверти идут с неубывающим x и невозрастающим y, поэтому
+//охватывающий прямоугольник куска из DIRTY_TILE_HEIGHT точек задают его
+//первая и последняя точки; отмечаются прямоугольники всех отражений куска
+template <class C>
+class SymmetricMarker {
+private:
+    C& canvas;
+    int xc, yc;
+    //отражать ещё и относительно диагонали (восемь октантов окружности)
+    bool octants;
+    int count = 0;
+    int x_first = 0, y_first = 0, x_last = 0, y_last = 0;
+    void markQuadrants(int x_lo, int x_hi, int y_lo, int y_hi) {
+        canvas.markDirtyClipped(yc + y_lo, xc + x_lo, yc + y_hi, xc + x_hi);
+        canvas.markDirtyClipped(yc + y_lo, xc - x_hi, yc + y_hi, xc - x_lo);
+        canvas.markDirtyClipped(yc - y_hi, xc + x_lo, yc - y_lo, xc + x_hi);
+        canvas.markDirtyClipped(yc - y_hi, xc - x_hi, yc - y_lo, xc - x_lo);
+    }
+public:
+    SymmetricMarker(C& canvas, int xc, int yc, bool octants)
+        : canvas(canvas), xc(xc), yc(yc), octants(octants) {}
+    ~SymmetricMarker() {
+        flush();
+    }
+    void add(int x, int y) {
+        if (count == 0) {
+            x_first = x;
+            y_first = y;
+        }
+        x_last = x;
+        y_last = y;
+        if (++count == (int)DIRTY_TILE_HEIGHT)
+            flush();
+    }
+    void flush() {
+        if (count == 0)
+            return;
+        markQuadrants(x_first, x_last, y_last, y_first);
+        if (octants)
+            markQuadrants(y_last, y_first, x_first, x_last);
+        count = 0;
+    }
+};
+
+template <class C>
+void drawPointOnCircle(C& canvas, int xc, int yc, int x, int y) {
+    plotClipped(canvas, yc + y, xc + x);
+    plotClipped(canvas, yc + x, xc + y);
+    plotClipped(canvas, yc - x, xc + y);
+    plotClipped(canvas, yc - y, xc + x);
+    plotClipped(canvas, yc - y, xc - x);
+    plotClipped(canvas, yc - x, xc - y);
+    plotClipped(canvas, yc + x, xc - y);
+    plotClipped(canvas, yc + y, xc - x);
+}
+
+//Описанный квадрат фигуры не пересекает холст
+template <class C>
+bool outsideCanvas(const C& canvas, int xc, int yc, int rx, int ry) {
+    return xc + rx < 0 || yc + ry < 0 ||
+           xc - rx >= (int)canvas.getWidth() || yc - ry >= (int)canvas.getHeight();
+}
+
+template <class C>
+void drawCircle(C& canvas, int xc, int yc, int r) {
+    //при r = 0 алгоритм ставит ещё и диагональных соседей центра, отсюда r + 1
+    if (r < 0 || outsideCanvas(canvas, xc, yc, r + 1, r + 1))
+        return;
+    SymmetricMarker<C> marker(canvas, xc, yc, true);
+    int x = 0;
+    int y = r;
+    int d = 3 - 2*r;
+    drawPointOnCircle(canvas, xc, yc, x, y);
+    marker.add(x, y);
+    while (y >= x) {
+        x++;
+        if (d > 0) {
+            y--;
+            d = d + 4 * (x - y) + 10;
+        } else {
+            d = d + 4 * x + 6;
+        }
+        drawPointOnCircle(canvas, xc, yc, x, y);
+        marker.add(x, y);
+    }
+}
+
+//Закрашенный круг: тот же шаг алгоритма, что в drawCircle, но вместо восьми
+//точек - отрезки строк между симметричными точками. Строки yc +- y
+//выводятся один раз, перед сменой y, с наибольшим для него x
+template <class C>
+void fillCircle(C& canvas, int xc, int yc, int r) {
+    //при r = 0 алгоритм ставит ещё и диагональных соседей центра, отсюда r + 1
+    if (r < 0 || outsideCanvas(canvas, xc, yc, r + 1, r + 1))
+        return;
+    typename C::Value ink = canvas.getInk();
+    int x = 0;
+    int y = r;
+    int d = 3 - 2*r;
+    canvas.fillSpan(yc, xc - y, xc + y, ink);
+    while (y >= x) {
+        x++;
+        if (d > 0) {
+            canvas.fillSpan(yc + y, xc - (x - 1), xc + (x - 1), ink);
+            canvas.fillSpan(yc - y, xc - (x - 1), xc + (x - 1), ink);
+            y--;
+            d = d + 4 * (x - y) + 10;
+        } else {
+            d = d + 4 * x + 6;
+        }
+        canvas.fillSpan(yc + x, xc - y, xc + y, ink);
+        canvas.fillSpan(yc - x, xc - y, xc + y, ink);
+    }
+    canvas.fillSpan(yc + y, xc - x, xc + x, ink);
+    canvas.fillSpan(yc - y, xc - x, xc + x, ink);
+}
+
+//Алгоритм средней точки для эллипса с осями rx, ry. Решающие переменные
+//умножены на 4, чтобы обойтись целыми числами. visit(x, y) вызывается для
+//каждой точки первой четверти, y не возрастает
+template <class Visitor>
+void midpointEllipse(int rx, int ry, Visitor visit) {
+    if (ry == 0) {
+        for (int x = 0; x <= rx; x++)
+            visit(x, 0);
+        return;
+    }
+    long long rx2 = (long long)rx * rx;
+    long long ry2 = (long long)ry * ry;
+    long long x = 0;
+    long long y = ry;
+    long long dx = 0;
+    long long dy = 2 * rx2 * y;
+    long long d = 4 * ry2 - 4 * rx2 * ry + rx2;
+    while (dx < dy) {
+        visit((int)x, (int)y);
+        x++;
+        dx += 2 * ry2;
+        if (d < 0) {
+            d += 4 * (dx + ry2);
+        } else {
+            y--;
+            dy -= 2 * rx2;
+            d += 4 * (dx - dy + ry2);
+        }
+    }
+    d = ry2 * (2 * x + 1) * (2 * x + 1) + 4 * rx2 * (y - 1) * (y - 1) - 4 * rx2 * ry2;
+    while (y >= 0) {
+        visit((int)x, (int)y);
+        y--;
+        dy -= 2 * rx2;
+        if (d > 0) {
+            d += 4 * (rx2 - dy);
+        } else {
+            x++;
+            dx += 2 * ry2;
+            d += 4 * (dx - dy + rx2);
+        }
+    }
+}
+
+template <class C>
+void drawEllipse(C& canvas, int xc, int yc, int rx, int ry) {
+    if (rx < 0 || ry < 0 || outsideCanvas(canvas, xc, yc, rx, ry))
+        return;
+    SymmetricMarker<C> marker(canvas, xc, yc, false);
+    midpointEllipse(rx, ry, [&](int x, int y) {
+        marker.add(x, y);
+        plotClipped(canvas, yc + y, xc + x);
+        plotClipped(canvas, yc + y, xc - x);
+        plotClipped(canvas, yc - y, xc + x);
+        plotClipped(canvas, yc - y, xc - x);
+    });
+}
+
+template <class C>
+void fillEllipse(C& canvas, int xc, int yc, int rx, int ry) {
+    if (rx < 0 || ry < 0 || outsideCanvas(canvas, xc, yc, rx, ry))
+        return;
+    typename C::Value ink = canvas.getInk();
+    int spanY = ry;
+    int spanX = 0;
+    midpointEllipse(rx, ry, [&](int x, int y) {
+        if (y != spanY) {
+            canvas.fillSpan(yc + spanY, xc - spanX, xc + spanX, ink);
+            canvas.fillSpan(yc - spanY, xc - spanX, xc + spanX, ink);
+            spanY = y;
+        }
+        spanX = x;
+    });
+    canvas.fillSpan(yc + spanY, xc - spanX, xc + spanX, ink);
+    canvas.fillSpan(yc - spanY, xc - spanX, xc + spanX, ink);
+}
+
+typedef void (*LineAlgorithm)(Canvas&, int, int, int, int);
+
+template <class C>
+void drawTriangle(C& canvas, int x1, int y1, int x2, int y2, int x3, int y3) {
+    brezenchemAlgorithm(canvas, y1, x1, y2, x2);
+    brezenchemAlgorithm(canvas, y2, x2, y3, x3);
+    brezenchemAlgorithm(canvas, y3, x3, y1, x1);
+}
+
+//Полуплоскость ребра: E(x, y) = a*x + b*y + c >= 0 внутри треугольника.
+//Правило верхнего-левого ребра учтено сдвигом c: пиксель на общем ребре
+//двух треугольников закрашивает только один из них
+struct EdgeFunction {
+    long long a, b, c;
+    void setup(int x1, int y1, int x2, int y2) {
+        a = (long long)y1 - y2;
+        b = (long long)x2 - x1;
+        c = -(a * x1 + b * y1);
+        bool topLeft = a > 0 || (a == 0 && b > 0);
+        if (!topLeft)
+            c -= 1;
+    }
+    long long at(int x, int y) const {
+        return a * x + b * y + c;
+    }
+};
+
+//блок 16x8: строка блока - ровно один SSE-регистр
+const int TRIANGLE_BLOCK_WIDTH = 16;
+const int TRIANGLE_BLOCK_HEIGHT = 8;
+//ограничение на координаты, при котором промежуточные значения в
+//fillTriangle и wuAlgorithm не переполняются; фигуры за ним не рисуются
+const int COORD_LIMIT = 1 << 24;
+
+//Закрашивает строку частично покрытого блока. Проверяются только рёбра,
+//которые пересекают блок, остальные заведомо выполнены. Пересечение строки
+//с треугольником - один отрезок, он и заливается
+template <class C>
+void fillTriangleBlockRow(C& canvas, int bx, int left, int right, int y,
+                          const EdgeFunction* edges, const int* partial, int partialCount) {
+#ifdef __SSE2__
+    __m128i lane = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i mask = _mm_and_si128(_mm_cmpgt_epi8(lane, _mm_set1_epi8(left - bx - 1)),
+                                 _mm_cmplt_epi8(lane, _mm_set1_epi8(right - bx + 1)));
+    __m128i minusOne = _mm_set1_epi32(-1);
+    for (int k = 0; k < partialCount; k++) {
+        const EdgeFunction& edge = edges[partial[k]];
+        int base = (int)edge.at(bx, y);
+        int a = (int)edge.a;
+        __m128i step = _mm_set1_epi32(4 * a);
+        __m128i v0 = _mm_setr_epi32(base, base + a, base + 2 * a, base + 3 * a);
+        __m128i v1 = _mm_add_epi32(v0, step);
+        __m128i v2 = _mm_add_epi32(v1, step);
+        __m128i v3 = _mm_add_epi32(v2, step);
+        __m128i low = _mm_packs_epi32(_mm_cmpgt_epi32(v0, minusOne), _mm_cmpgt_epi32(v1, minusOne));
+        __m128i high = _mm_packs_epi32(_mm_cmpgt_epi32(v2, minusOne), _mm_cmpgt_epi32(v3, minusOne));
+        mask = _mm_and_si128(mask, _mm_packs_epi16(low, high));
+    }
+    unsigned int bits = _mm_movemask_epi8(mask);
+    if (bits != 0)
+        canvas.fillRow(y, bx + __builtin_ctz(bits), bx + 31 - __builtin_clz(bits), canvas.getInk());
+#else
+    int first = right + 1, last = left - 1;
+    for (int x = left; x <= right; x++) {
+        bool inside = true;
+        for (int k = 0; k < partialCount && inside; k++)
+            inside = edges[partial[k]].at(x, y) >= 0;
+        if (inside) {
+            first = min(first, x);
+            last = x;
+        }
+    }
+    if (first <= last)
+        canvas.fillRow(y, first, last, canvas.getInk());
+#endif
+}
+
+//Закрашенный треугольник по функциям рёбер. Блоки целиком вне треугольника
+//отбрасываются, целиком внутри - заливаются строками, остальные считаются
+//по 16 пикселей за шаг
+template <class C>
+void fillTriangle(C& canvas, int x1, int y1, int x2, int y2, int x3, int y3) {
+    //треугольник с вершиной дальше COORD_LIMIT отбрасывается без отрисовки
+    int coords[] = {x1, y1, x2, y2, x3, y3};
+    for (int i = 0; i < 6; i++)
+        if (coords[i] < -COORD_LIMIT || coords[i] > COORD_LIMIT)
+            return;
+    long long area = (long long)(x2 - x1) * (y3 - y1) - (long long)(y2 - y1) * (x3 - x1);
+    if (area == 0)
+        return;
+    if (area < 0) {
+        swap(x2, x3);
+        swap(y2, y3);
+    }
+    EdgeFunction edges[3];
+    edges[0].setup(x1, y1, x2, y2);
+    edges[1].setup(x2, y2, x3, y3);
+    edges[2].setup(x3, y3, x1, y1);
+    int x_min = max(min(x1, min(x2, x3)), 0);
+    int x_max = min(max(x1, max(x2, x3)), (int)canvas.getWidth() - 1);
+    int y_min = max(min(y1, min(y2, y3)), 0);
+    int y_max = min(max(y1, max(y2, y3)), (int)canvas.getHeight() - 1);
+    if (x_min > x_max || y_min > y_max)
+        return;
+    int bxStart = x_min - x_min % TRIANGLE_BLOCK_WIDTH;
+    for (int by = y_min; by <= y_max; by += TRIANGLE_BLOCK_HEIGHT) {
+        int byEnd = min(by + TRIANGLE_BLOCK_HEIGHT - 1, y_max);
+        for (int bx = bxStart; bx <= x_max; bx += TRIANGLE_BLOCK_WIDTH) {
+            int bxEnd = bx + TRIANGLE_BLOCK_WIDTH - 1;
+            int partial[3];
+            int partialCount = 0;
+            bool rejected = false;
+            for (int e = 0; e < 3 && !rejected; e++) {
+                long long c00 = edges[e].at(bx, by);
+                long long c10 = edges[e].at(bxEnd, by);
+                long long c01 = edges[e].at(bx, byEnd);
+                long long c11 = edges[e].at(bxEnd, byEnd);
+                if (c00 < 0 && c10 < 0 && c01 < 0 && c11 < 0)
+                    rejected = true;
+                else if (c00 < 0 || c10 < 0 || c01 < 0 || c11 < 0)
+                    partial[partialCount++] = e;
+            }
+            if (rejected)
+                continue;
+            int left = max(bx, x_min);
+            int right = min(bxEnd, x_max);
+            for (int y = by; y <= byEnd; y++) {
+                if (partialCount == 0)
+                    canvas.fillRow(y, left, right, canvas.getInk());
+                else
+                    fillTriangleBlockRow(canvas, bx, left, right, y, edges, partial, partialCount);
+            }
+        }
+    }
+}
+
+struct Point {
+    int x, y;
+};
+
+enum class FillRule {
+    EvenOdd,
+    NonZero
+};
+
+long long floorDiv(long long a, long long b) {
+    return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+//Ребро многоугольника, активное на строках y_top <= y < y_bottom.
+//x - ceil(точки пересечения со строкой), remainder = x*dy - числитель,
+//пересечение сдвигается на dx/dy за строку без деления
+struct PolygonEdge {
+    int y_top, y_bottom;
+    int x;
+    long long remainder;
+    int dy;
+    int stepQuotient, stepRemainder;
+    int winding;
+    void start(const Point& from, const Point& to, int y) {
+        long long dx = (long long)to.x - from.x;
+        dy = to.y - from.y;
+        long long numerator = (long long)from.x * dy + (long long)(y - from.y) * dx;
+        x = (int)ceilDiv(numerator, dy);
+        remainder = (long long)x * dy - numerator;
+        stepQuotient = (int)floorDiv(dx, dy);
+        stepRemainder = (int)(dx - (long long)stepQuotient * dy);
+    }
+    void advance() {
+        remainder -= stepRemainder;
+        if (remainder < 0) {
+            remainder += dy;
+            x += stepQuotient + 1;
+        } else {
+            x += stepQuotient;
+        }
+    }
+};
+
+//Заливка многоугольника (можно из нескольких контуров, самопересекающегося)
+//построчным алгоритмом с таблицей рёбер и списком активных рёбер.
+//Пиксель (x, y) закрашивается, если точка (x, y) внутри; на границе действует
+//то же правило верхнего-левого ребра, что и в fillTriangle
+template <class C>
+void fillPolygon(C& canvas, const vector<vector<Point>>& contours, FillRule rule = FillRule::EvenOdd) {
+    int width = canvas.getWidth();
+    int height = canvas.getHeight();
+    vector<PolygonEdge> edges;
+    vector<Point> tops;
+    for (size_t c = 0; c < contours.size(); c++) {
+        const vector<Point>& points = contours[c];
+        for (size_t i = 0; i < points.size(); i++) {
+            Point from = points[i];
+            Point to = points[(i + 1) % points.size()];
+            if (from.y == to.y)
+                continue;
+            PolygonEdge edge;
+            edge.winding = 1;
+            if (from.y > to.y) {
+                swap(from, to);
+                edge.winding = -1;
+            }
+            if (to.y <= 0 || from.y >= height)
+                continue;
+            edge.y_top = from.y;
+            edge.y_bottom = to.y;
+            edges.push_back(edge);
+            tops.push_back(from);
+            tops.push_back(to);
+        }
+    }
+    if (edges.empty())
+        return;
+    //таблица рёбер: индексы, упорядоченные по верхней строке
+    vector<unsigned int> table(edges.size());
+    for (size_t i = 0; i < table.size(); i++)
+        table[i] = i;
+    sort(table.begin(), table.end(), [&](unsigned int a, unsigned int b) {
+        return edges[a].y_top < edges[b].y_top;
+    });
+    int y = max(edges[table[0]].y_top, 0);
+    size_t nextEdge = 0;
+    vector<PolygonEdge*> active;
+    while (y < height && (nextEdge < table.size() || !active.empty())) {
+        if (active.empty() && edges[table[nextEdge]].y_top > y)
+            y = edges[table[nextEdge]].y_top;
+        while (nextEdge < table.size() && edges[table[nextEdge]].y_top <= y) {
+            unsigned int index = table[nextEdge++];
+            edges[index].start(tops[2 * index], tops[2 * index + 1], y);
+            active.push_back(&edges[index]);
+        }
+        //список почти упорядочен с прошлой строки, поэтому сортировка вставками
+        for (size_t i = 1; i < active.size(); i++) {
+            PolygonEdge* edge = active[i];
+            size_t j = i;
+            for (; j > 0 && active[j - 1]->x > edge->x; j--)
+                active[j] = active[j - 1];
+            active[j] = edge;
+        }
+        int winding = 0;
+        for (size_t i = 0; i + 1 < active.size(); i++) {
+            bool inside;
+            if (rule == FillRule::EvenOdd) {
+                inside = i % 2 == 0;
+            } else {
+                winding += active[i]->winding;
+                inside = winding != 0;
+            }
+            if (!inside)
+                continue;
+            int left = max(active[i]->x, 0);
+            int right = min(active[i + 1]->x, width);
+            if (left < right)
+                canvas.fillRow(y, left, right - 1, canvas.getInk());
+        }
+        y++;
+        size_t kept = 0;
+        for (size_t i = 0; i < active.size(); i++) {
+            if (active[i]->y_bottom > y) {
+                active[i]->advance();
+                active[kept++] = active[i];
+            }
+        }
+        active.resize(kept);
+    }
+}
+
+template <class C>
+void fillPolygon(C& canvas, const vector<Point>& points, FillRule rule = FillRule::EvenOdd) {
+    fillPolygon(canvas, vector<vector<Point>>(1, points), rule);
+}
+
+//Отрезок строки y, соседний с уже залитым отрезком строки y - dy:
+//его пиксели ещё предстоит проверить
+struct FillSpan {
+    int y;
+    int x_left, x_right;
+    int dy;
+};
+
+//Построчная заливка области цвета затравки (4-связность) цветом кисти.
+//Каждая найденная серия расширяется до границ и заливается одной записью;
+//в стек кладутся соседние строки: следующая целиком, обратная - только
+//за пределами родительского отрезка, где она ещё не проверена.
+//Стек явный, передаётся снаружи и может переиспользоваться между вызовами
+template <class C>
+void floodFill(C& canvas, int y, int x, vector<FillSpan>& stack) {
+    if (!canvas.contains(y, x))
+        return;
+    size_t stride = canvas.pixelStride();
+    typename C::Value target = canvas.load(y * stride + x);
+    typename C::Value ink = canvas.getInk();
+    if (target == ink)
+        return;
+    int width = canvas.getWidth();
+    int height = canvas.getHeight();
+    auto inside = [&](int row, int column) {
+        return canvas.load(row * stride + column) == target;
+    };
+    auto push = [&](int row, int x_left, int x_right, int dy) {
+        if (row >= 0 && row < height && x_left <= x_right)
+            stack.push_back(FillSpan{row, x_left, x_right, dy});
+    };
+    stack.clear();
+    push(y, x, x, 1);
+    //затравка - вырожденный родитель: обратную строку проверяем целиком
+    push(y - 1, x, x, -1);
+    while (!stack.empty()) {
+        FillSpan span = stack.back();
+        stack.pop_back();
+        int column = span.x_left;
+        while (column <= span.x_right) {
+            if (!inside(span.y, column)) {
+                column++;
+                continue;
+            }
+            int left = column;
+            if (left == span.x_left)
+                while (left > 0 && inside(span.y, left - 1))
+                    left--;
+            int right = column;
+            while (right < width - 1 && inside(span.y, right + 1))
+                right++;
+            canvas.fillRow(span.y, left, right, ink);
+            push(span.y + span.dy, left, right, span.dy);
+            push(span.y - span.dy, left, span.x_left - 1, -span.dy);
+            push(span.y - span.dy, span.x_right + 1, right, -span.dy);
+            column = right + 2;
+        }
+    }
+}
+
+template <class C>
+void floodFill(C& canvas, int y, int x) {
+    vector<FillSpan> stack;
+    stack.reserve(2 * canvas.getHeight() + 16);
+    floodFill(canvas, y, x, stack);
+}
+
+//допустимое отклонение уплощённой кривой от настоящей, в пикселях
+const double PATH_FLATNESS = 0.25;
+//предельная глубина деления кривой: 2^16 отрезков на кривую
+const int PATH_MAX_DEPTH = 16;
+
+//Кривая Безье третьего порядка, вершины в дробных координатах
+struct CubicCurve {
+    double x[4], y[4];
+    //Кривая лежит в выпуклой оболочке контрольных точек, поэтому она
+    //отклоняется от хорды P0-P3 не больше, чем P1 и P2 отклоняются от отрезка
+    bool flat(double tolerance) const {
+        double dx = x[3] - x[0], dy = y[3] - y[0];
+        double length2 = dx * dx + dy * dy;
+        for (int i = 1; i <= 2; i++) {
+            double px = x[i] - x[0], py = y[i] - y[0];
+            if (length2 == 0) {
+                if (px * px + py * py > tolerance * tolerance)
+                    return false;
+                continue;
+            }
+            double cross = px * dy - py * dx;
+            double dot = px * dx + py * dy;
+            if (cross * cross > tolerance * tolerance * length2 || dot < 0 || dot > length2)
+                return false;
+        }
+        return true;
+    }
+    //Деление пополам по де Кастельжо
+    void split(CubicCurve& left, CubicCurve& right) const {
+        double x01 = (x[0] + x[1]) / 2, y01 = (y[0] + y[1]) / 2;
+        double x12 = (x[1] + x[2]) / 2, y12 = (y[1] + y[2]) / 2;
+        double x23 = (x[2] + x[3]) / 2, y23 = (y[2] + y[3]) / 2;
+        double xa = (x01 + x12) / 2, ya = (y01 + y12) / 2;
+        double xb = (x12 + x23) / 2, yb = (y12 + y23) / 2;
+        double xm = (xa + xb) / 2, ym = (ya + yb) / 2;
+        CubicCurve l = {{x[0], x01, xa, xm}, {y[0], y01, ya, ym}};
+        CubicCurve r = {{xm, xb, x23, x[3]}, {ym, yb, y23, y[3]}};
+        left = l;
+        right = r;
+    }
+};
+
+//Добавляет вершину, пропуская повтор предыдущей
+void appendVertex(vector<Point>& points, double x, double y) {
+    Point point = {(int)floor(x + 0.5), (int)floor(y + 0.5)};
+    if (points.empty() || points.back().x != point.x || points.back().y != point.y)
+        points.push_back(point);
+}
+
+//Адаптивное уплощение: плоские куски сразу становятся одним отрезком,
+//изогнутые делятся дальше. Стек явный, левая половина обрабатывается
+//первой, поэтому вершины выходят по порядку. Начальная точка кривой
+//в points не добавляется - она уже там как конец предыдущего участка
+void flattenCubic(const CubicCurve& curve, vector<Point>& points) {
+    CubicCurve stack[PATH_MAX_DEPTH + 1];
+    int depth[PATH_MAX_DEPTH + 1];
+    int top = 0;
+    stack[0] = curve;
+    depth[0] = 0;
+    while (top >= 0) {
+        CubicCurve current = stack[top];
+        int level = depth[top];
+        top--;
+        if (level == PATH_MAX_DEPTH || current.flat(PATH_FLATNESS)) {
+            appendVertex(points, current.x[3], current.y[3]);
+            continue;
+        }
+        CubicCurve left, right;
+        current.split(left, right);
+        stack[++top] = right;
+        depth[top] = level + 1;
+        stack[++top] = left;
+        depth[top] = level + 1;
+    }
+}
+
+//Ломаная, у которой пиксель каждого стыка ставится один раз: отрезки после
+//первого начинаются со второго шага. У замкнутой ломаной последний отрезок
+//не ставит свой конец - это начало первого. Если inside, все вершины
+//внутри rect и отрезки идут без отсечения
+template <class C>
+void drawPolylineIn(C& canvas, const ClipRect& rect, bool inside, const Point* points, size_t count, bool closed) {
+    if (count == 0)
+        return;
+    LineClip clip;
+    if (count == 1) {
+        if (clipLine(rect, points[0].y, points[0].x, points[0].y, points[0].x, clip))
+            drawClippedLine(canvas, clip);
+        return;
+    }
+    //отрезок туда и обратно замыкать нечего
+    if (count == 2)
+        closed = false;
+    size_t segments = closed ? count : count - 1;
+    for (size_t i = 0; i < segments; i++) {
+        const Point& from = points[i];
+        const Point& to = points[(i + 1) % count];
+        if (inside)
+            setupLine(from.y, from.x, to.y, to.x, clip);
+        else if (!clipLine(rect, from.y, from.x, to.y, to.x, clip))
+            continue;
+        if (i > 0 && clip.first == 0)
+            clip.first = 1;
+        if (closed && i + 1 == segments && clip.last == clip.d_major)
+            clip.last--;
+        if (clip.first <= clip.last)
+            drawClippedLine(canvas, clip);
+    }
+}
+
+//Охватывающий прямоугольник вершин: false, если он не задевает rect;
+//inside - лежит ли он в rect целиком
+bool boundsAgainst(const ClipRect& rect, const vector<const vector<Point>*>& contours, bool& inside) {
+    int x_min = INT_MAX, y_min = INT_MAX, x_max = INT_MIN, y_max = INT_MIN;
+    for (size_t c = 0; c < contours.size(); c++) {
+        const vector<Point>& points = *contours[c];
+        for (size_t i = 0; i < points.size(); i++) {
+            x_min = min(x_min, points[i].x);
+            x_max = max(x_max, points[i].x);
+            y_min = min(y_min, points[i].y);
+            y_max = max(y_max, points[i].y);
+        }
+    }
+    if (x_min > x_max || x_max < rect.x_min || x_min > rect.x_max || y_max < rect.y_min || y_min > rect.y_max)
+        return false;
+    inside = x_min >= rect.x_min && x_max <= rect.x_max && y_min >= rect.y_min && y_max <= rect.y_max;
+    return true;
+}
+
+template <class C>
+void drawPolyline(C& canvas, const vector<Point>& points, bool closed = false) {
+    ClipRect rect = canvasRect(canvas);
+    bool inside;
+    if (boundsAgainst(rect, vector<const vector<Point>*>(1, &points), inside))
+        drawPolylineIn(canvas, rect, inside, points.data(), points.size(), closed);
+}
+
+//Путь из контуров: отрезки и кривые второго и третьего порядка, кривые
+//уплощаются сразу при добавлении
+class Path {
+public:
+    struct Contour {
+        vector<Point> points;
+        bool closed;
+    };
+private:
+    vector<Contour> contours;
+    Point& current() {
+        if (contours.empty())
+            throw runtime_error("path has no current point");
+        return contours.back().points.back();
+    }
+public:
+    void moveTo(int x, int y) {
+        Contour contour;
+        contour.points.push_back(Point{x, y});
+        contour.closed = false;
+        contours.push_back(contour);
+    }
+    void lineTo(int x, int y) {
+        Point from = current();
+        if (from.x != x || from.y != y)
+            contours.back().points.push_back(Point{x, y});
+    }
+    //квадратичная кривая - частный случай кубической с контрольными
+    //точками P0 + 2/3 (C - P0) и P2 + 2/3 (C - P2)
+    void quadTo(int cx, int cy, int x, int y) {
+        Point from = current();
+        CubicCurve curve = {{(double)from.x, from.x + 2.0 * (cx - from.x) / 3, x + 2.0 * (cx - x) / 3, (double)x},
+                            {(double)from.y, from.y + 2.0 * (cy - from.y) / 3, y + 2.0 * (cy - y) / 3, (double)y}};
+        flattenCubic(curve, contours.back().points);
+    }
+    void cubicTo(int c1x, int c1y, int c2x, int c2y, int x, int y) {
+        Point from = current();
+        CubicCurve curve = {{(double)from.x, (double)c1x, (double)c2x, (double)x},
+                            {(double)from.y, (double)c1y, (double)c2y, (double)y}};
+        flattenCubic(curve, contours.back().points);
+    }
+    //замыкает контур отрезком к его началу
+    void close() {
+        current();
+        vector<Point>& points = contours.back().points;
+        if (points.size() > 1 && points.back().x == points[0].x && points.back().y == points[0].y)
+            points.pop_back();
+        contours.back().closed = true;
+    }
+    const vector<Contour>& getContours() const {
+        return contours;
+    }
+};
+
+//Контур пути рисуется ломаной; прямоугольник пути проверяется один раз на
+//весь путь: путь вне холста отбрасывается, путь внутри рисуется без отсечения
+template <class C>
+void drawPath(C& canvas, const Path& path) {
+    const vector<Path::Contour>& contours = path.getContours();
+    vector<const vector<Point>*> points(contours.size());
+    for (size_t c = 0; c < contours.size(); c++)
+        points[c] = &contours[c].points;
+    ClipRect rect = canvasRect(canvas);
+    bool inside;
+    if (!boundsAgainst(rect, points, inside))
+        return;
+    for (size_t c = 0; c < contours.size(); c++)
+        drawPolylineIn(canvas, rect, inside, contours[c].points.data(), contours[c].points.size(), contours[c].closed);
+}
+
+//Заливка области, ограниченной контурами пути (контуры считаются замкнутыми)
+template <class C>
+void fillPath(C& canvas, const Path& path, FillRule rule = FillRule::NonZero) {
+    const vector<Path::Contour>& contours = path.getContours();
+    vector<vector<Point>> polygons(contours.size());
+    for (size_t c = 0; c < contours.size(); c++)
+        polygons[c] = contours[c].points;
+    fillPolygon(canvas, polygons, rule);
+}
+
+template <class C>
+void drawQuadraticBezier(C& canvas, Point p0, Point p1, Point p2) {
+    Path path;
+    path.moveTo(p0.x, p0.y);
+    path.quadTo(p1.x, p1.y, p2.x, p2.y);
+    drawPath(canvas, path);
+}
+
+template <class C>
+void drawCubicBezier(C& canvas, Point p0, Point p1, Point p2, Point p3) {
+    Path path;
+    path.moveTo(p0.x, p0.y);
+    path.cubicTo(p1.x, p1.y, p2.x, p2.y, p3.x, p3.y);
+    drawPath(canvas, path);
+}
+
+//Шаги i из [first, last], на которых floor((start + i*gradient) / 2^32) лежит в [lo, hi]
+bool fixedPointRange(long long start, long long gradient, long long lo, long long hi,
+                     int first, int last, int& from, int& to) {
+    const long long one = 1LL << 32;
+    long long low = lo * one;
+    long long high = (hi + 1) * one;
+    long long a = first, b = last;
+    if (gradient > 0) {
+        a = max(a, ceilDiv(low - start, gradient));
+        b = min(b, ceilDiv(high - start, gradient) - 1);
+    } else if (gradient < 0) {
+        a = max(a, floorDiv(start - high, -gradient) + 1);
+        b = min(b, floorDiv(start - low, -gradient));
+    } else if (start < low || start >= high) {
+        return false;
+    }
+    if (a > b)
+        return false;
+    from = (int)a;
+    to = (int)b;
+    return true;
+}
+
+inline void blendCoverage(unsigned char* cell, int coverage) {
+    if (*cell < coverage)
+        *cell = coverage;
+}
+
+//Сглаженный отрезок по алгоритму Ву. Положение по второй оси ведётся в
+//формате 32.32, старшие 8 бит дробной части - покрытие нижней из двух ячеек.
+//Отрезок отсекается один раз: шаги, где видны обе ячейки, идут без проверок,
+//проверка остаётся только у краёв холста
+void wuAlgorithm(CoverageCanvas& canvas, int y_start, int x_start, int y_end, int x_end) {
+    //отрезок дальше COORD_LIMIT отбрасывается, как невидимый у clipLine
+    int coords[] = {y_start, x_start, y_end, x_end};
+    for (int i = 0; i < 4; i++)
+        if (coords[i] < -COORD_LIMIT || coords[i] > COORD_LIMIT)
+            return;
+    bool xMajor = abs(x_end - x_start) >= abs(y_end - y_start);
+    if ((xMajor && x_start > x_end) || (!xMajor && y_start > y_end)) {
+        swap(x_start, x_end);
+        swap(y_start, y_end);
+    }
+    int majorStart = xMajor ? x_start : y_start;
+    int minorStart = xMajor ? y_start : x_start;
+    int d_major = xMajor ? x_end - x_start : y_end - y_start;
+    int d_minor = xMajor ? y_end - y_start : x_end - x_start;
+    int majorSize = xMajor ? canvas.getWidth() : canvas.getHeight();
+    int minorSize = xMajor ? canvas.getHeight() : canvas.getWidth();
+    long long majorStep = xMajor ? 1 : canvas.getStride();
+    long long minorStep = xMajor ? canvas.getStride() : 1;
+    int first, last;
+    if (!clipAxis(majorStart, 1, d_major, 0, majorSize - 1, first, last))
+        return;
+    long long gradient = d_major ? d_minor * (1LL << 32) / d_major : 0;
+    long long start = (long long)minorStart * (1LL << 32);
+    //видна хотя бы одна ячейка пары - база в [-1, minorSize - 1]
+    int visibleFrom, visibleTo;
+    if (!fixedPointRange(start, gradient, -1, minorSize - 1, first, last, visibleFrom, visibleTo))
+        return;
+    //видны обе ячейки - база в [0, minorSize - 2]
+    int innerFrom = visibleTo + 1, innerTo = visibleTo;
+    if (minorSize < 2 || !fixedPointRange(start, gradient, 0, minorSize - 2, visibleFrom, visibleTo, innerFrom, innerTo)) {
+        innerFrom = visibleTo + 1;
+        innerTo = visibleTo;
+    }
+    //охватывающий прямоугольник видимой части: база монотонна по шагам
+    int baseFirst = (int)((start + visibleFrom * gradient) >> 32);
+    int baseLast = (int)((start + visibleTo * gradient) >> 32);
+    int minorLo = max(min(baseFirst, baseLast), 0);
+    int minorHi = min(max(baseFirst, baseLast) + 1, minorSize - 1);
+    if (xMajor)
+        canvas.markDirty(minorLo, majorStart + visibleFrom, minorHi, majorStart + visibleTo);
+    else
+        canvas.markDirty(majorStart + visibleFrom, minorLo, majorStart + visibleTo, minorHi);
+    //смещения ячеек ведутся целыми: указатель берётся только на ячейку
+    //внутри холста, база -1 и шаг за концом отрезка его не образуют
+    unsigned char* cells = canvas.row(0);
+    long long origin = majorStart * majorStep;
+    auto plotChecked = [&](int from, int to) {
+        for (int i = from; i <= to; i++) {
+            long long position = start + i * gradient;
+            long long base = position >> 32;
+            int coverage = (position >> 24) & 0xFF;
+            long long index = origin + i * majorStep + base * minorStep;
+            if (base >= 0)
+                blendCoverage(cells + index, 255 - coverage);
+            if (base + 1 < minorSize)
+                blendCoverage(cells + index + minorStep, coverage);
+        }
+    };
+    plotChecked(visibleFrom, innerFrom - 1);
+    if (innerFrom <= innerTo) {
+        long long position = start + innerFrom * gradient;
+        long long base = position >> 32;
+        long long index = origin + innerFrom * majorStep + base * minorStep;
+        for (int i = innerFrom; i <= innerTo; i++) {
+            int coverage = (position >> 24) & 0xFF;
+            blendCoverage(cells + index, 255 - coverage);
+            blendCoverage(cells + index + minorStep, coverage);
+            position += gradient;
+            index += majorStep;
+            long long next = position >> 32;
+            if (next != base) {
+                index += (next - base) * minorStep;
+                base = next;
+            }
+        }
+    }
+    plotChecked(innerTo + 1, visibleTo);
+}
+
+//Каркасная 3D-графика: вершины модели проходят через матрицу 4x4 пачками,
+//рёбра рисуются brezenchemAlgorithm. Матрица хранится по строкам и
+//умножается на столбец (x, y, z, 1)
+struct Matrix4 {
+    float m[16];
+    float& at(int row, int column) {
+        return m[row * 4 + column];
+    }
+    float at(int row, int column) const {
+        return m[row * 4 + column];
+    }
+    static Matrix4 identity() {
+        Matrix4 result = {};
+        for (int i = 0; i < 4; i++)
+            result.at(i, i) = 1;
+        return result;
+    }
+    static Matrix4 translation(float x, float y, float z) {
+        Matrix4 result = identity();
+        result.at(0, 3) = x;
+        result.at(1, 3) = y;
+        result.at(2, 3) = z;
+        return result;
+    }
+    static Matrix4 scaling(float x, float y, float z) {
+        Matrix4 result = identity();
+        result.at(0, 0) = x;
+        result.at(1, 1) = y;
+        result.at(2, 2) = z;
+        return result;
+    }
+    //Поворот вокруг оси axis (0 - x, 1 - y, 2 - z) против часовой стрелки,
+    //если смотреть с конца оси
+    static Matrix4 rotation(int axis, float angle) {
+        Matrix4 result = identity();
+        int a = (axis + 1) % 3, b = (axis + 2) % 3;
+        float c = cos(angle), s = sin(angle);
+        result.at(a, a) = c;
+        result.at(a, b) = -s;
+        result.at(b, a) = s;
+        result.at(b, b) = c;
+        return result;
+    }
+    //Перспектива как в OpenGL: камера в начале координат смотрит вдоль -z,
+    //видимая область z от -zNear до -zFar, ближняя плоскость - z = -w
+    static Matrix4 perspective(float fovY, float aspect, float zNear, float zFar) {
+        Matrix4 result = {};
+        float f = 1 / tan(fovY / 2);
+        result.at(0, 0) = f / aspect;
+        result.at(1, 1) = f;
+        result.at(2, 2) = (zFar + zNear) / (zNear - zFar);
+        result.at(2, 3) = 2 * zFar * zNear / (zNear - zFar);
+        result.at(3, 2) = -1;
+        return result;
+    }
+    //Из нормализованных координат [-1, 1] в ячейки холста, y вниз.
+    //w не меняется, поэтому отсечение после неё работает как прежде
+    static Matrix4 viewport(unsigned int height, unsigned int width) {
+        Matrix4 result = identity();
+        float halfWidth = (width - 1) / 2.0f, halfHeight = (height - 1) / 2.0f;
+        result.at(0, 0) = halfWidth;
+        result.at(0, 3) = halfWidth;
+        result.at(1, 1) = -halfHeight;
+        result.at(1, 3) = halfHeight;
+        return result;
+    }
+};
+
+Matrix4 operator*(const Matrix4& a, const Matrix4& b) {
+    Matrix4 result = {};
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            for (int k = 0; k < 4; k++)
+                result.at(i, j) += a.at(i, k) * b.at(k, j);
+    return result;
+}
+
+typedef vector<float, AlignedAllocator<float, 16>> FloatArray;
+
+struct MeshEdge {
+    unsigned int a, b;
+    //грани по обе стороны ребра, -1 - грани нет; третья и следующие
+    //грани ребра не учитываются
+    int faces[2];
+};
+
+//Каркасная модель. Координаты вершин лежат отдельными массивами (SoA),
+//чтобы преобразование брало по четыре вершины за шаг. Грань - выпуклый
+//плоский многоугольник, вершины против часовой стрелки, если смотреть
+//снаружи; грани нужны для отсечения задних граней и буфера глубины
+class Mesh {
+private:
+    FloatArray x, y, z;
+    vector<MeshEdge> edges;
+    unordered_map<uint64_t, unsigned int> edgeIndex;
+    //вершины грани f - faceVertices[faceStart[f]..faceStart[f + 1])
+    vector<unsigned int> faceVertices;
+    vector<unsigned int> faceStart;
+    unsigned int findEdge(unsigned int a, unsigned int b) {
+        if (a >= x.size() || b >= x.size() || a == b)
+            throw runtime_error("bad mesh edge");
+        uint64_t key = (uint64_t)min(a, b) << 32 | max(a, b);
+        auto found = edgeIndex.find(key);
+        if (found != edgeIndex.end())
+            return found->second;
+        MeshEdge edge = {a, b, {-1, -1}};
+        edges.push_back(edge);
+        edgeIndex[key] = edges.size() - 1;
+        return edges.size() - 1;
+    }
+public:
+    Mesh() : faceStart(1, 0) {}
+    unsigned int addVertex(float vx, float vy, float vz) {
+        x.push_back(vx);
+        y.push_back(vy);
+        z.push_back(vz);
+        return x.size() - 1;
+    }
+    //ребро без граней рисуется всегда
+    void addEdge(unsigned int a, unsigned int b) {
+        findEdge(a, b);
+    }
+    //рёбра грани добавляются сами, общие рёбра соседних граней не повторяются
+    void addFace(const vector<unsigned int>& vertices) {
+        if (vertices.size() < 3)
+            throw runtime_error("face needs three vertices");
+        int face = faceStart.size() - 1;
+        for (size_t i = 0; i < vertices.size(); i++) {
+            MeshEdge& edge = edges[findEdge(vertices[i], vertices[(i + 1) % vertices.size()])];
+            if (edge.faces[0] < 0)
+                edge.faces[0] = face;
+            else if (edge.faces[1] < 0)
+                edge.faces[1] = face;
+        }
+        faceVertices.insert(faceVertices.end(), vertices.begin(), vertices.end());
+        faceStart.push_back(faceVertices.size());
+    }
+    size_t vertexCount() const {
+        return x.size();
+    }
+    size_t faceCount() const {
+        return faceStart.size() - 1;
+    }
+    const FloatArray& getX() const {
+        return x;
+    }
+    const FloatArray& getY() const {
+        return y;
+    }
+    const FloatArray& getZ() const {
+        return z;
+    }
+    const vector<MeshEdge>& getEdges() const {
+        return edges;
+    }
+    const vector<unsigned int>& getFaceVertices() const {
+        return faceVertices;
+    }
+    const vector<unsigned int>& getFaceStart() const {
+        return faceStart;
+    }
+};
+
+//Куб с центром в начале координат: 8 вершин, 6 граней, 12 рёбер
+Mesh cubeMesh(float half) {
+    Mesh mesh;
+    //бит 0 вершины - знак x, бит 1 - y, бит 2 - z
+    for (int i = 0; i < 8; i++)
+        mesh.addVertex(i & 1 ? half : -half, i & 2 ? half : -half, i & 4 ? half : -half);
+    unsigned int faces[6][4] = {{0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4},
+                                {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5}};
+    for (int f = 0; f < 6; f++)
+        mesh.addFace(vector<unsigned int>(faces[f], faces[f] + 4));
+    return mesh;
+}
+
+//Вершины после преобразования: однородные координаты (cx, cy, cz, cw)
+//и экранные sx = cx/w, sy = cy/w, rw = 1/w
+struct ProjectedVertices {
+    FloatArray cx, cy, cz, cw;
+    FloatArray sx, sy, rw;
+    void resize(size_t count) {
+        FloatArray* arrays[] = {&cx, &cy, &cz, &cw, &sx, &sy, &rw};
+        for (int k = 0; k < 7; k++)
+            arrays[k]->resize(count);
+    }
+};
+
+//Преобразование массивов координат одной матрицей. Четыре вершины за шаг:
+//элементы матрицы размножены по регистрам, каждая выходная координата -
+//три умножения и три сложения сразу для четырёх вершин
+void transformVertices(const Matrix4& matrix, const float* x, const float* y, const float* z,
+                       size_t count, ProjectedVertices& out) {
+    out.resize(count);
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128 m[16];
+    for (int k = 0; k < 16; k++)
+        m[k] = _mm_set1_ps(matrix.m[k]);
+    __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= count; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+        __m128 row[4];
+        for (int r = 0; r < 4; r++)
+            row[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m[4 * r], vx), _mm_mul_ps(m[4 * r + 1], vy)),
+                                           _mm_mul_ps(m[4 * r + 2], vz)), m[4 * r + 3]);
+        __m128 inverse = _mm_div_ps(one, row[3]);
+        _mm_store_ps(&out.cx[i], row[0]);
+        _mm_store_ps(&out.cy[i], row[1]);
+        _mm_store_ps(&out.cz[i], row[2]);
+        _mm_store_ps(&out.cw[i], row[3]);
+        _mm_store_ps(&out.sx[i], _mm_mul_ps(row[0], inverse));
+        _mm_store_ps(&out.sy[i], _mm_mul_ps(row[1], inverse));
+        _mm_store_ps(&out.rw[i], inverse);
+    }
+#endif
+    //остаток - с тем же порядком операций, что и в векторной части
+    for (; i < count; i++) {
+        float row[4];
+        for (int r = 0; r < 4; r++)
+            row[r] = matrix.m[4 * r] * x[i] + matrix.m[4 * r + 1] * y[i] + matrix.m[4 * r + 2] * z[i] + matrix.m[4 * r + 3];
+        float inverse = 1.0f / row[3];
+        out.cx[i] = row[0];
+        out.cy[i] = row[1];
+        out.cz[i] = row[2];
+        out.cw[i] = row[3];
+        out.sx[i] = row[0] * inverse;
+        out.sy[i] = row[1] * inverse;
+        out.rw[i] = inverse;
+    }
+}
+
+//Буфер глубины по ячейкам холста. Хранится 1/w ближайшей грани (0 - граней
+//нет): 1/w линейна по экрану и интерполируется без деления, больше - ближе
+class DepthBuffer {
 private:
     unsigned int height;
     unsigned int width;
-    vector<vector<char>> canvas = vector<vector<char>>();
-    void initVector() {
-        vector<char> tmp;
-        canvas.clear();
-        for (unsigned int i = 0; i < height; i++) {
-            tmp = vector<char>();
-            for (unsigned int j = 0; j < width; j++)
-                tmp.push_back(' ');
-            canvas.push_back(tmp);
+    vector<float> depth;
+public:
+    DepthBuffer(unsigned int height, unsigned int width) : height(height), width(width), depth((size_t)height * width, 0) {}
+    unsigned int getHeight() const {
+        return height;
+    }
+    unsigned int getWidth() const {
+        return width;
+    }
+    void clear() {
+        fill(depth.begin(), depth.end(), 0.0f);
+    }
+    float* row(unsigned int y) {
+        return &depth[(size_t)y * width];
+    }
+    const float* row(unsigned int y) const {
+        return &depth[(size_t)y * width];
+    }
+};
+
+//Насколько (в долях 1/w) ребро может быть дальше грани и всё ещё считаться
+//лежащим на ней: запас на погрешность float
+const float DEPTH_BIAS = 0.001f;
+//Рёбра отсекаются в однородных координатах по ближней плоскости и по
+//полосе GUARD_BAND ячеек вокруг холста; точное отсечение по холсту
+//остаётся brezenchemAlgorithm, а координаты после деления на w влезают в int
+const float GUARD_BAND = 1 << 20;
+
+//Отрезок с проверкой глубины в каждой ячейке. 1/w меняется линейно вдоль
+//главной оси; ячейка рисуется, если отрезок не дальше записанной грани
+template <class C>
+void drawDepthTestedLine(C& canvas, const DepthBuffer& depth, int y_start, int x_start, float r_start,
+                         int y_end, int x_end, float r_end) {
+    LineClip clip;
+    if (!clipLine(canvasRect(canvas), y_start, x_start, y_end, x_end, clip))
+        return;
+    markClippedLine(canvas, clip);
+    int m = clip.minorOffset(clip.first);
+    int x = clip.x_start + clip.stepX * (clip.xMajor ? clip.first : m);
+    int y = clip.y_start + clip.stepY * (clip.xMajor ? m : clip.first);
+    long long stride = canvas.pixelStride();
+    long long width = depth.getWidth();
+    long long pixel = y * stride + x;
+    const float* cell = depth.row(0) + y * width + x;
+    typename C::Value ink = canvas.getInk();
+    long long majorStep = clip.xMajor ? clip.stepX : clip.stepY * stride;
+    long long minorStep = clip.xMajor ? clip.stepY * stride : clip.stepX;
+    long long majorCell = clip.xMajor ? clip.stepX : clip.stepY * width;
+    long long minorCell = clip.xMajor ? clip.stepY * width : clip.stepX;
+    long long error = 2LL * clip.first * clip.d_minor - 2LL * m * clip.d_major;
+    float gradient = clip.d_major > 0 ? (r_end - r_start) / clip.d_major : 0;
+    for (int i = clip.first; i <= clip.last; i++) {
+        if (i > clip.first) {
+            pixel += majorStep;
+            cell += majorCell;
+            error += 2LL * clip.d_minor;
+            if (error >= clip.d_major) {
+                error -= 2LL * clip.d_major;
+                pixel += minorStep;
+                cell += minorCell;
+            }
+        }
+        if ((r_start + gradient * i) * (1 + DEPTH_BIAS) >= *cell)
+            canvas.store(pixel, ink);
+    }
+}
+
+//Закраска треугольника в буфер глубины: в ячейки, центры которых внутри
+//треугольника, пишется интерполированное 1/w, если оно ближе записанного.
+//Значение отодвигается на изменение 1/w за одну ячейку: ребро, концы которого
+//округлены до ячеек, отходит от грани не дальше, и на наклонных гранях
+//его не закрывает собственная грань
+void fillDepthTriangle(DepthBuffer& depth, const float* a, const float* b, const float* c) {
+    double area = (double)(b[0] - a[0]) * (c[1] - a[1]) - (double)(b[1] - a[1]) * (c[0] - a[0]);
+    if (area == 0)
+        return;
+    double x_low = max(min(a[0], min(b[0], c[0])), 0.0f);
+    double x_high = min(max(a[0], max(b[0], c[0])), depth.getWidth() - 1.0f);
+    double y_low = max(min(a[1], min(b[1], c[1])), 0.0f);
+    double y_high = min(max(a[1], max(b[1], c[1])), depth.getHeight() - 1.0f);
+    int x_min = (int)ceil(x_low), x_max = (int)floor(x_high);
+    int y_min = (int)ceil(y_low), y_max = (int)floor(y_high);
+    //барицентрические веса: доли площади против каждой вершины
+    const float* v[3] = {a, b, c};
+    double stepX[3], stepY[3], origin[3];
+    for (int k = 0; k < 3; k++) {
+        const float* p = v[(k + 1) % 3];
+        const float* q = v[(k + 2) % 3];
+        stepX[k] = (p[1] - q[1]) / area;
+        stepY[k] = (q[0] - p[0]) / area;
+        origin[k] = ((double)p[0] * q[1] - (double)q[0] * p[1]) / area;
+    }
+    //1/w в ячейке (x, y) - rowDepth + gradient * x
+    double gradient = stepX[0] * a[2] + stepX[1] * b[2] + stepX[2] * c[2];
+    double gradientY = stepY[0] * a[2] + stepY[1] * b[2] + stepY[2] * c[2];
+    double offset = fabs(gradient) + fabs(gradientY);
+    double originDepth = origin[0] * a[2] + origin[1] * b[2] + origin[2] * c[2] - offset;
+    for (int y = y_min; y <= y_max; y++) {
+        //ячейки строки, где все три веса неотрицательны, - один отрезок
+        double left = x_min, right = x_max;
+        for (int k = 0; k < 3; k++) {
+            double weight = origin[k] + stepY[k] * y;
+            if (stepX[k] > 0)
+                left = max(left, ceil(-weight / stepX[k]));
+            else if (stepX[k] < 0)
+                right = min(right, floor(-weight / stepX[k]));
+            else if (weight < 0)
+                right = left - 1;
+        }
+        if (left > right)
+            continue;
+        float* row = depth.row(y);
+        double rowDepth = originDepth + gradientY * y;
+        for (int x = (int)left; x <= (int)right; x++) {
+            float value = (float)(rowDepth + gradient * x);
+            if (value > row[x])
+                row[x] = value;
+        }
+    }
+}
+
+//Рисование каркасных моделей. Рабочие массивы хранятся между вызовами,
+//поэтому кадр анимации не выделяет память. Порядок: преобразование всех
+//вершин, ориентация граней (и запись их в буфер глубины), затем рёбра
+class WireframeRenderer {
+private:
+    ProjectedVertices projected;
+    vector<char> faceVisible;
+    //экранный многоугольник грани после отсечения: тройки (x, y, 1/w)
+    vector<float> polygon;
+    bool insideVertex(unsigned int v) const {
+        float w = projected.cw[v];
+        return projected.cz[v] + w >= 0 && fabs(projected.cx[v]) <= GUARD_BAND * w &&
+               fabs(projected.cy[v]) <= GUARD_BAND * w;
+    }
+    //Грань на экране; вершины за ближней плоскостью отсекаются
+    //(Сазерленд-Ходжмен по одной плоскости z = -w)
+    void facePolygon(const Mesh& mesh, size_t face) {
+        polygon.clear();
+        const unsigned int* vertices = &mesh.getFaceVertices()[mesh.getFaceStart()[face]];
+        size_t count = mesh.getFaceStart()[face + 1] - mesh.getFaceStart()[face];
+        for (size_t i = 0; i < count; i++) {
+            unsigned int p = vertices[i], q = vertices[(i + 1) % count];
+            float d_p = projected.cz[p] + projected.cw[p];
+            float d_q = projected.cz[q] + projected.cw[q];
+            if (d_p >= 0) {
+                polygon.push_back(projected.sx[p]);
+                polygon.push_back(projected.sy[p]);
+                polygon.push_back(projected.rw[p]);
+            }
+            if ((d_p >= 0) != (d_q >= 0)) {
+                float t = d_p / (d_p - d_q);
+                float w = projected.cw[p] + (projected.cw[q] - projected.cw[p]) * t;
+                polygon.push_back((projected.cx[p] + (projected.cx[q] - projected.cx[p]) * t) / w);
+                polygon.push_back((projected.cy[p] + (projected.cy[q] - projected.cy[p]) * t) / w);
+                polygon.push_back(1 / w);
+            }
+        }
+    }
+    //Отсечение ребра в однородных координатах (Лян-Барски): видимая часть
+    //t из [t0, t1]; false, если ребро не видно
+    bool clipEdge(unsigned int a, unsigned int b, float& t0, float& t1) const {
+        float va[4] = {projected.cx[a], projected.cy[a], projected.cz[a], projected.cw[a]};
+        float vb[4] = {projected.cx[b], projected.cy[b], projected.cz[b], projected.cw[b]};
+        //расстояния до плоскостей: ближняя и четыре стороны полосы
+        float da[5] = {va[2] + va[3], GUARD_BAND * va[3] - va[0], GUARD_BAND * va[3] + va[0],
+                       GUARD_BAND * va[3] - va[1], GUARD_BAND * va[3] + va[1]};
+        float db[5] = {vb[2] + vb[3], GUARD_BAND * vb[3] - vb[0], GUARD_BAND * vb[3] + vb[0],
+                       GUARD_BAND * vb[3] - vb[1], GUARD_BAND * vb[3] + vb[1]};
+        t0 = 0;
+        t1 = 1;
+        for (int k = 0; k < 5; k++) {
+            if (da[k] < 0 && db[k] < 0)
+                return false;
+            if (da[k] < 0)
+                t0 = max(t0, da[k] / (da[k] - db[k]));
+            else if (db[k] < 0)
+                t1 = min(t1, da[k] / (da[k] - db[k]));
+        }
+        return t0 <= t1;
+    }
+    void clippedPoint(unsigned int a, unsigned int b, float t, float* point) const {
+        float w = projected.cw[a] + (projected.cw[b] - projected.cw[a]) * t;
+        point[0] = (projected.cx[a] + (projected.cx[b] - projected.cx[a]) * t) / w;
+        point[1] = (projected.cy[a] + (projected.cy[b] - projected.cy[a]) * t) / w;
+        point[2] = 1 / w;
+    }
+public:
+    //рёбра, все грани которых повёрнуты от камеры, не рисуются
+    bool cullBackFaces = true;
+    const ProjectedVertices& getProjected() const {
+        return projected;
+    }
+    //transform - проекция * вид * модель; перевод в ячейки холста добавляется
+    //здесь. С буфером глубины грани модели сначала записываются в него, и
+    //рёбра, закрытые гранями (этой или ранее нарисованных моделей), не рисуются.
+    //Буфер очищает вызывающий, обычно раз за кадр
+    template <class C>
+    void draw(C& canvas, const Mesh& mesh, const Matrix4& transform, DepthBuffer* depth = nullptr) {
+        if (depth != nullptr && (depth->getHeight() != canvas.getHeight() || depth->getWidth() != canvas.getWidth()))
+            throw runtime_error("depth buffer size mismatch");
+        Matrix4 full = Matrix4::viewport(canvas.getHeight(), canvas.getWidth()) * transform;
+        transformVertices(full, mesh.getX().data(), mesh.getY().data(), mesh.getZ().data(), mesh.vertexCount(), projected);
+        faceVisible.assign(mesh.faceCount(), 1);
+        if (cullBackFaces || depth != nullptr) {
+            for (size_t f = 0; f < mesh.faceCount(); f++) {
+                facePolygon(mesh, f);
+                size_t count = polygon.size() / 3;
+                double area = 0;
+                for (size_t i = 0; i < count; i++) {
+                    const float* p = &polygon[3 * i];
+                    const float* q = &polygon[3 * ((i + 1) % count)];
+                    area += (double)p[0] * q[1] - (double)q[0] * p[1];
+                }
+                //ось y экрана направлена вниз, поэтому лицевая грань идёт по часовой
+                if (cullBackFaces)
+                    faceVisible[f] = count >= 3 && area < 0;
+                //у замкнутой модели задние грани всегда закрыты лицевыми,
+                //поэтому при отсечении в буфер пишутся только лицевые
+                if (depth != nullptr && faceVisible[f])
+                    for (size_t i = 1; i + 1 < count; i++)
+                        fillDepthTriangle(*depth, &polygon[0], &polygon[3 * i], &polygon[3 * i + 3]);
+            }
+        }
+        const vector<MeshEdge>& edges = mesh.getEdges();
+        for (size_t e = 0; e < edges.size(); e++) {
+            const MeshEdge& edge = edges[e];
+            if (edge.faces[0] >= 0 && !faceVisible[edge.faces[0]] &&
+                (edge.faces[1] < 0 || !faceVisible[edge.faces[1]]))
+                continue;
+            float start[3], end[3];
+            if (insideVertex(edge.a) && insideVertex(edge.b)) {
+                start[0] = projected.sx[edge.a];
+                start[1] = projected.sy[edge.a];
+                start[2] = projected.rw[edge.a];
+                end[0] = projected.sx[edge.b];
+                end[1] = projected.sy[edge.b];
+                end[2] = projected.rw[edge.b];
+            } else {
+                float t0, t1;
+                if (!clipEdge(edge.a, edge.b, t0, t1))
+                    continue;
+                clippedPoint(edge.a, edge.b, t0, start);
+                clippedPoint(edge.a, edge.b, t1, end);
+            }
+            int x0 = (int)floor(start[0] + 0.5f), y0 = (int)floor(start[1] + 0.5f);
+            int x1 = (int)floor(end[0] + 0.5f), y1 = (int)floor(end[1] + 0.5f);
+            if (depth == nullptr)
+                brezenchemAlgorithm(canvas, y0, x0, y1, x1);
+            else
+                drawDepthTestedLine(canvas, *depth, y0, x0, start[2], y1, x1, end[2]);
+        }
+    }
+};
+
+template <class C>
+void drawWireframe(C& canvas, const Mesh& mesh, const Matrix4& transform, DepthBuffer* depth = nullptr) {
+    WireframeRenderer renderer;
+    renderer.draw(canvas, mesh, transform, depth);
+}
+
+//Расписание кадров по дедлайнам: кадр n показывается в момент start + n * period,
+//поэтому время отрисовки и вывода не добавляется к паузам. Если кадр опоздал
+//больше чем на период, отсчёт начинается заново от него - без серии кадров
+//вдогонку. Нулевая частота - без пауз
+class FrameClock {
+private:
+    chrono::steady_clock::duration period;
+    chrono::steady_clock::time_point deadline;
+    bool started = false;
+public:
+    explicit FrameClock(double fps) {
+        setRate(fps);
+    }
+    void setRate(double fps) {
+        period = chrono::steady_clock::duration::zero();
+        if (fps > 0)
+            period = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(1 / fps));
+        started = false;
+    }
+    //Ждёт дедлайна очередного кадра
+    void wait() {
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (!started) {
+            deadline = now;
+            started = true;
         }
+        if (deadline > now)
+            this_thread::sleep_until(deadline);
+        else if (now - deadline > period)
+            deadline = now;
+        deadline += period;
+    }
+};
+
+//Конвейер кадров: потоки пула рисуют задания (случаи демонстрации, кадры
+//анимации) наперёд, один поток вывода показывает готовые кадры по порядку
+//заданий и по FrameClock. Рисование и вывод идут одновременно.
+//Задание отдаёт кадр через emit(): холст с кадром уходит в очередь вывода,
+//а рисование продолжается на чистом холсте из запаса; показанный холст
+//очищается и возвращается в запас. Два последних свободных холста достаются
+//только заданию, кадры которого сейчас выводятся (ему нужен рабочий холст
+//и холст под кадр), поэтому задания, ушедшие вперёд, не могут занять весь
+//запас и остановить вывод
+class FramePipeline {
+private:
+    struct Frame {
+        Canvas* canvas;
+        string caption;
+    };
+    ThreadPool pool;
+    vector<unique_ptr<Canvas>> canvases;
+    vector<Canvas*> idle;
+    mutex lock;
+    condition_variable changed;
+    //готовые кадры каждого задания и признак его завершения
+    vector<deque<Frame>> ready;
+    vector<char> finished;
+    //задание, кадры которого выводятся
+    size_t head = 0;
+    size_t starved = 0;
+    //задание потока рисования и подпись к его следующему кадру
+    static thread_local size_t currentJob;
+    static thread_local string pendingCaption;
+    Canvas* acquire(unique_lock<mutex>& guard, size_t job) {
+        changed.wait(guard, [&] { return idle.size() > (job == head ? 0u : 2u); });
+        Canvas* canvas = idle.back();
+        idle.pop_back();
+        return canvas;
     }
 public:
-    Canvas(unsigned int height, unsigned int width) {
-        this->height = height;
-        this->width = width;
-        if (height == 0 || width == 0)
-            throw runtime_error("zero size");
-        initVector();
+    //poolSize = 0 - по два холста на поток и два в запасе для выводимого задания
+    FramePipeline(unsigned int height, unsigned int width, unsigned int threads, unsigned int poolSize = 0)
+        : pool(max(threads, 1u)) {
+        if (poolSize == 0)
+            poolSize = 2 * pool.size() + 2;
+        for (unsigned int i = 0; i < max(poolSize, 2u); i++) {
+            canvases.push_back(unique_ptr<Canvas>(new Canvas(height, width)));
+            idle.push_back(canvases.back().get());
+        }
     }
-    void clear() {
-        initVector();
+    unsigned int threads() const {
+        return pool.size();
     }
-    void setElement(int y, int x, char element) {
-        if ( y < 0 || x < 0 || y >= height || x >= width)
-            throw runtime_error("out of range insertion");
-        canvas[y][x] = element;
+    //сколько раз вывод ждал кадр, который ещё рисовался
+    size_t starvedFrames() const {
+        return starved;
     }
-    void print(ofstream& file) {
-        for (unsigned int i = 0; i < width; i++) {
-            std::cout << "-";
-            if (file.is_open())
-                file << "-";
-        }
-        std::cout << std::endl;
-        if (file.is_open())
-            file << std::endl;
-        for (unsigned int i = 0; i < height; i++) {
-            std::cout << "|";
-            if (file.is_open())
-                file << "|";
-            for (unsigned int j = 0; j < width; j++) {
-                std::cout << canvas[i][j];
-                if (file.is_open())
-                    file << canvas[i][j];
-            }
-            std::cout << "|" << std::endl;
-            if (file.is_open())
-                file << "|" << std::endl;
-        }
-        for (unsigned int i = 0; i < width; i++) {
-            std::cout << "-";
-            if (file.is_open())
-                file << "-";
-        }
-        std::cout << std::endl;
-        if (file.is_open())
-            file << std::endl;
-    }
-};
-
-void brezenchemAlgorithm(Canvas& canvas, int y_start, int x_start, int y_end, int x_end) {
-    float error = 0;
-    float delta_error;
-    int dx = abs(x_end - x_start);
-    int dy = abs(y_end - y_start);
-    int stepX = (x_start < x_end) ? 1 : -1;
-    int stepY = (y_start < y_end) ? 1 : -1;
-    int x = x_start;
-    int y = y_start;
-    canvas.setElement(y, x, '*');
-    if (dx >= dy) {
-        delta_error = (float)dy/dx;
-        for (int i = 1; i <= dx; i++) {
-            x+=stepX;
-            error += delta_error;
-            if (error >= 0.5) {
-                error -= 1;
-                y+=stepY;
-            }
-            //std::cout << x << ";" << y << ";" << error << ";" << dx << ";" << dy << std::endl;
-            canvas.setElement(y, x, '*');
+    //render(job, canvas) рисует задание на чистом холсте и отдаёт кадры через
+    //emit(); present(canvas, caption) вызывается в потоке вывода в порядке
+    //заданий, пауза перед каждым кадром - clock.wait()
+    void run(size_t jobs, const function<void(size_t, Canvas&)>& render,
+             const function<void(Canvas&, const string&)>& present, FrameClock& clock) {
+        {
+            lock_guard<mutex> guard(lock);
+            ready.assign(jobs, deque<Frame>());
+            finished.assign(jobs, 0);
+            head = 0;
+            starved = 0;
         }
-    }
-    else {
-        delta_error = (float)dx/dy;
-        for (int i = 1; i <= dy; i++) {
-            y+=stepY;
-            error += delta_error;
-            if (error >= 0.5) {
-                error -= 1;
-                x+=stepX;
+        thread output([&] {
+            for (size_t job = 0; job < jobs; job++) {
+                while (true) {
+                    Frame frame;
+                    {
+                        unique_lock<mutex> guard(lock);
+                        if (ready[job].empty() && !finished[job])
+                            starved++;
+                        changed.wait(guard, [&] { return !ready[job].empty() || finished[job]; });
+                        if (ready[job].empty())
+                            break;
+                        frame = std::move(ready[job].front());
+                        ready[job].pop_front();
+                    }
+                    clock.wait();
+                    present(*frame.canvas, frame.caption);
+                    frame.canvas->clear();
+                    {
+                        lock_guard<mutex> guard(lock);
+                        idle.push_back(frame.canvas);
+                    }
+                    changed.notify_all();
+                }
+                {
+                    lock_guard<mutex> guard(lock);
+                    head = job + 1;
+                }
+                changed.notify_all();
             }
-            canvas.setElement(y, x, '*');
+        });
+        pool.parallelFor(jobs, [&](unsigned int job) {
+            currentJob = job;
+            pendingCaption.clear();
+            Canvas* canvas;
+            {
+                unique_lock<mutex> guard(lock);
+                canvas = acquire(guard, job);
+            }
+            render(job, *canvas);
+            //нарисованное после последнего кадра не показывается
+            canvas->clear();
+            {
+                lock_guard<mutex> guard(lock);
+                idle.push_back(canvas);
+                finished[job] = 1;
+            }
+            changed.notify_all();
+        });
+        output.join();
+    }
+    //Отдаёт кадр задания текущего потока; canvas после вызова чистый
+    void emit(Canvas& canvas) {
+        Canvas* frame;
+        {
+            unique_lock<mutex> guard(lock);
+            frame = acquire(guard, currentJob);
+        }
+        swap(*frame, canvas);
+        {
+            lock_guard<mutex> guard(lock);
+            ready[currentJob].push_back(Frame{frame, pendingCaption});
         }
+        pendingCaption.clear();
+        changed.notify_all();
     }
-}
+    //Подпись выводится перед следующим кадром задания текущего потока
+    void caption(const string& text) {
+        pendingCaption += text;
+        pendingCaption += '\n';
+    }
+};
+
+thread_local size_t FramePipeline::currentJob = 0;
+thread_local string FramePipeline::pendingCaption;
 
-void drawPointOnCircle(Canvas& canvas, int xc, int yc, int x, int y) {
-    canvas.setElement(yc + y, xc + x, '*');
-    canvas.setElement(yc + x, xc + y, '*');
-    canvas.setElement(yc - x, xc + y, '*');
-    canvas.setElement(yc - y, xc + x, '*');
-    canvas.setElement(yc - y, xc - x, '*');
-    canvas.setElement(yc - x, xc - y, '*');
-    canvas.setElement(yc + x, xc - y, '*');
-    canvas.setElement(yc + y, xc - x, '*');
+//При ненулевом значении демонстрация выводит в терминал только изменения
+TerminalView* terminalView = nullptr;
+//При ненулевом значении кадры демонстрации публикуются в кольцо
+FrameRing* frameStream = nullptr;
+//При ненулевом значении кадры демонстрации только сохраняются, без вывода и пауз
+vector<string>* capturedFrames = nullptr;
+//При ненулевом значении кадры демонстрации рисуются наперёд в конвейере
+FramePipeline* framePipeline = nullptr;
+//Частота кадров демонстрации
+FrameClock frameClock(1);
+
+void showCaption(const char* text) {
+    if (capturedFrames != nullptr)
+        return;
+    if (framePipeline != nullptr)
+        framePipeline->caption(text);
+    else
+        std::cout << text << std::endl;
 }
 
-void drawCircle(Canvas& canvas, int xc, int yc, int r) {
-    int x = 0;
-    int y = r;
-    int d = 3 - 2*r;
-    drawPointOnCircle(canvas, xc, yc, x, y);
-    while (y >= x) {
-        x++;
-        if (d > 0) {
-            y--;
-            d = d + 4 * (x - y) + 10;
-        } else {
-            d = d + 4 * x + 6;
+//Вывод кадра во все включённые потоки вывода, без пауз и очистки
+void presentFrame(Canvas& canvas, ofstream& file) {
+    if (frameStream != nullptr)
+        frameStream->publish(canvas);
+    if (terminalView == nullptr) {
+        canvas.print(file);
+    } else {
+        terminalView->present(canvas);
+        if (file.is_open()) {
+            const string& text = canvas.frame();
+            file.write(text.data(), text.size());
+            file.flush();
         }
-        drawPointOnCircle(canvas, xc, yc, x, y);
     }
 }
 
-void drawTriangle(Canvas& canvas, int x1, int y1, int x2, int y2, int x3, int y3) {
-    brezenchemAlgorithm(canvas, y1, x1, y2, x2);
-    brezenchemAlgorithm(canvas, y2, x2, y3, x3);
-    brezenchemAlgorithm(canvas, y3, x3, y1, x1);
+void showFrame(Canvas& canvas, ofstream& file) {
+    if (capturedFrames != nullptr) {
+        capturedFrames->push_back(canvas.frame());
+        canvas.clear();
+        return;
+    }
+    if (framePipeline != nullptr) {
+        framePipeline->emit(canvas);
+        return;
+    }
+    frameClock.wait();
+    presentFrame(canvas, file);
+    canvas.clear();
 }
 
-void test_case1(Canvas& canvas, ofstream& file) {
-    std::cout << "1/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 10, 19);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 12, 17);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 14, 14);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    std::cout << "2/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 15, 14);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 17, 12);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 19, 10);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+void test_case1(Canvas& canvas, ofstream& file, LineAlgorithm line = brezenchemAlgorithm) {
+    showCaption("1/8 четверть");
+    line(canvas, 10, 10, 10, 19);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 12, 17);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 14, 14);
+    showFrame(canvas, file);
+    showCaption("2/8 четверть");
+    line(canvas, 10, 10, 15, 14);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 17, 12);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 19, 10);
+    showFrame(canvas, file);
 }
 
-void test_case2(Canvas& canvas, ofstream& file) {
-    std::cout << "3/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 19, 10);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 17, 8);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 15, 5);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    std::cout << "4/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 14, 4);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 12, 2);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 10, 0);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+void test_case2(Canvas& canvas, ofstream& file, LineAlgorithm line = brezenchemAlgorithm) {
+    showCaption("3/8 четверть");
+    line(canvas, 10, 10, 19, 10);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 17, 8);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 15, 5);
+    showFrame(canvas, file);
+    showCaption("4/8 четверть");
+    line(canvas, 10, 10, 14, 4);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 12, 2);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 10, 0);
+    showFrame(canvas, file);
 }
 
-void test_case3(Canvas& canvas, ofstream& file) {
-    std::cout << "5/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 10, 0);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 8, 2);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 5, 5);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    std::cout << "6/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 3, 7);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 2, 8);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 0, 10);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+void test_case3(Canvas& canvas, ofstream& file, LineAlgorithm line = brezenchemAlgorithm) {
+    showCaption("5/8 четверть");
+    line(canvas, 10, 10, 10, 0);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 8, 2);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 5, 5);
+    showFrame(canvas, file);
+    showCaption("6/8 четверть");
+    line(canvas, 10, 10, 3, 7);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 2, 8);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 0, 10);
+    showFrame(canvas, file);
 }
 
-void test_case4(Canvas& canvas, ofstream& file) {
-    std::cout << "7/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 0, 10);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 2, 12);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 5, 15);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    std::cout << "8/8 четверть" << std::endl;
-    brezenchemAlgorithm(canvas, 10, 10, 7, 17);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 8, 18);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
-    brezenchemAlgorithm(canvas, 10, 10, 10, 19);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+void test_case4(Canvas& canvas, ofstream& file, LineAlgorithm line = brezenchemAlgorithm) {
+    showCaption("7/8 четверть");
+    line(canvas, 10, 10, 0, 10);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 2, 12);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 5, 15);
+    showFrame(canvas, file);
+    showCaption("8/8 четверть");
+    line(canvas, 10, 10, 7, 17);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 8, 18);
+    showFrame(canvas, file);
+    line(canvas, 10, 10, 10, 19);
+    showFrame(canvas, file);
 }
 
 void test_case5(Canvas& canvas, ofstream& file) {
     drawCircle(canvas, 10, 10, 5);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+    showFrame(canvas, file);
     drawCircle(canvas, 10, 10, 9);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+    showFrame(canvas, file);
 }
 
 void test_case6(Canvas& canvas, ofstream& file) {
     drawTriangle(canvas, 0, 0, 10, 0, 10, 10);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+    showFrame(canvas, file);
     drawTriangle(canvas, 0, 0, 0, 10, 5, 5);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+    showFrame(canvas, file);
     drawTriangle(canvas, 0, 0, 16, 0, 10, 10);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+    showFrame(canvas, file);
 }
 
 void test_case7(Canvas& canvas, ofstream& file) {
@@ -290,31 +3415,1122 @@ void test_case7(Canvas& canvas, ofstream& file) {
     brezenchemAlgorithm(canvas, 10, 0, 0, 10);
     brezenchemAlgorithm(canvas, 5, 0, 5, 10);
     brezenchemAlgorithm(canvas, 0, 5, 10, 5);
-    canvas.print(file);
-    this_thread::sleep_for(chrono::seconds(1));
-    canvas.clear();
+    showFrame(canvas, file);
+}
+
+void test_case8(Canvas& canvas, ofstream& file) {
+    fillTriangle(canvas, 0, 0, 10, 0, 10, 10);
+    fillTriangle(canvas, 0, 0, 10, 10, 0, 10);
+    showFrame(canvas, file);
+    fillTriangle(canvas, 2, 1, 18, 6, 7, 18);
+    showFrame(canvas, file);
+}
+
+void test_case9(Canvas& canvas, ofstream& file) {
+    vector<Point> star = {{10, 1}, {15, 18}, {1, 7}, {19, 7}, {5, 18}};
+    fillPolygon(canvas, star, FillRule::EvenOdd);
+    showFrame(canvas, file);
+    fillPolygon(canvas, star, FillRule::NonZero);
+    showFrame(canvas, file);
+}
+
+void test_case10(Canvas& canvas, ofstream& file) {
+    fillCircle(canvas, 10, 10, 7);
+    showFrame(canvas, file);
+    fillEllipse(canvas, 10, 10, 9, 4);
+    drawCircle(canvas, 0, 19, 12);
+    showFrame(canvas, file);
+}
+
+void test_case11(Canvas& canvas, ofstream& file) {
+    CoverageCanvas coverage(canvas.getHeight(), canvas.getWidth());
+    wuAlgorithm(coverage, 2, 1, 17, 18);
+    wuAlgorithm(coverage, 18, 0, 5, 19);
+    wuAlgorithm(coverage, 0, 9, 19, 13);
+    toAscii(coverage, canvas);
+    showFrame(canvas, file);
+}
+
+void test_case12(Canvas& canvas, ofstream& file) {
+    drawTriangle(canvas, 1, 1, 18, 4, 6, 17);
+    floodFill(canvas, 6, 7);
+    showFrame(canvas, file);
+    drawCircle(canvas, 10, 10, 9);
+    drawCircle(canvas, 10, 10, 4);
+    floodFill(canvas, 10, 3);
+    showFrame(canvas, file);
+}
+
+void test_case13(Canvas& canvas, ofstream& file) {
+    drawCubicBezier(canvas, Point{0, 19}, Point{2, -6}, Point{17, 25}, Point{19, 0});
+    drawQuadraticBezier(canvas, Point{0, 0}, Point{10, 30}, Point{19, 2});
+    showFrame(canvas, file);
+    Path path;
+    path.moveTo(10, 1);
+    path.quadTo(19, 1, 18, 10);
+    path.cubicTo(17, 22, 3, 22, 2, 10);
+    path.lineTo(6, 4);
+    path.close();
+    fillPath(canvas, path);
+    showFrame(canvas, file);
+}
+
+void test_case14(Canvas& canvas, ofstream& file) {
+    Mesh cube = cubeMesh(1);
+    Matrix4 projection = Matrix4::perspective(1.0f, 1.0f, 0.5f, 50);
+    Matrix4 turn = Matrix4::rotation(0, 0.5f) * Matrix4::rotation(1, 0.6f);
+    WireframeRenderer renderer;
+    renderer.cullBackFaces = false;
+    renderer.draw(canvas, cube, projection * Matrix4::translation(0, 0, -4.5f) * turn);
+    showFrame(canvas, file);
+    //ближний куб закрывает часть дальнего
+    DepthBuffer depth(canvas.getHeight(), canvas.getWidth());
+    renderer.cullBackFaces = true;
+    renderer.draw(canvas, cube, projection * Matrix4::translation(-0.6f, -0.5f, -5) * turn, &depth);
+    renderer.draw(canvas, cube, projection * Matrix4::translation(1, 1, -8) * turn, &depth);
+    showFrame(canvas, file);
+}
+
+//Случаи демонстрации по порядку показа
+struct DemoCase {
+    string name;
+    function<void(Canvas&, ofstream&)> run;
+};
+
+vector<DemoCase> demoCases() {
+    vector<DemoCase> cases;
+    cases.push_back({"test_case1", [](Canvas& c, ofstream& f) { test_case1(c, f); }});
+    cases.push_back({"test_case2", [](Canvas& c, ofstream& f) { test_case2(c, f); }});
+    cases.push_back({"test_case3", [](Canvas& c, ofstream& f) { test_case3(c, f); }});
+    cases.push_back({"test_case4", [](Canvas& c, ofstream& f) { test_case4(c, f); }});
+    cases.push_back({"test_case1-runslice", [](Canvas& c, ofstream& f) { test_case1(c, f, runSliceAlgorithm); }});
+    cases.push_back({"test_case2-runslice", [](Canvas& c, ofstream& f) { test_case2(c, f, runSliceAlgorithm); }});
+    cases.push_back({"test_case3-runslice", [](Canvas& c, ofstream& f) { test_case3(c, f, runSliceAlgorithm); }});
+    cases.push_back({"test_case4-runslice", [](Canvas& c, ofstream& f) { test_case4(c, f, runSliceAlgorithm); }});
+    cases.push_back({"test_case5", test_case5});
+    cases.push_back({"test_case6", test_case6});
+    cases.push_back({"test_case7", test_case7});
+    cases.push_back({"test_case8", test_case8});
+    cases.push_back({"test_case9", test_case9});
+    cases.push_back({"test_case10", test_case10});
+    cases.push_back({"test_case11", test_case11});
+    cases.push_back({"test_case12", test_case12});
+    cases.push_back({"test_case13", test_case13});
+    cases.push_back({"test_case14", test_case14});
+    return cases;
 }
 
+//Пустое имя файла - кадры не пишутся в файл
 void test(Canvas& canvas, const string& filename) {
+    vector<DemoCase> cases = demoCases();
     while (true) {
-        std::ofstream file(filename, std::ios::trunc);
-        if (!file.is_open()) {
+        std::ofstream file;
+        if (!filename.empty())
+            file.open(filename, std::ios::trunc);
+        if (!filename.empty() && !file.is_open()) {
             std::cout << "Проблемы с открытием файла" << std::endl;
             return;
         }
-        test_case1(canvas, file);
-        test_case2(canvas, file);
-        test_case3(canvas, file);
-        test_case4(canvas, file);
-        test_case5(canvas, file);
-        test_case6(canvas, file);
-        test_case7(canvas, file);
+        if (framePipeline == nullptr) {
+            for (size_t i = 0; i < cases.size(); i++)
+                cases[i].run(canvas, file);
+        } else {
+            //готовые кадры копируются в canvas, чтобы вывод изменений и
+            //кольцо кадров видели один и тот же холст
+            framePipeline->run(cases.size(), [&](size_t job, Canvas& target) {
+                cases[job].run(target, file);
+            }, [&](Canvas& frame, const string& caption) {
+                std::cout << caption;
+                canvas.blit(frame, 0, 0);
+                presentFrame(canvas, file);
+            }, frameClock);
+        }
         file.close();
     }
 }
 
-int main() {
+#ifdef ZEROLAB_BENCH
+//Замер растеризаторов без вывода и пауз: каждый набор примитивов рисуется
+//iterations раз на очищенном холсте, время считается только для отрисовки
+struct BenchWorkload {
+    string name;
+    size_t primitives;
+    function<void(Canvas&)> draw;
+};
+
+double percentile(const vector<double>& sorted, double p) {
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+size_t countPixels(const Canvas& canvas) {
+    size_t count = 0;
+    for (unsigned int y = 0; y < canvas.getHeight(); y++) {
+        const char* row = canvas.row(y);
+        for (unsigned int x = 0; x < canvas.getWidth(); x++)
+            count += row[x] != ' ';
+    }
+    return count;
+}
+
+void runBenchmark(Canvas& canvas, const BenchWorkload& workload, int iterations) {
+    canvas.clear();
+    workload.draw(canvas);
+    size_t pixels = countPixels(canvas);
+    vector<double> times;
+    times.reserve(iterations);
+    for (int i = 0; i < iterations; i++) {
+        canvas.clear();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        workload.draw(canvas);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        times.push_back(chrono::duration<double, nano>(end - start).count());
+    }
+    sort(times.begin(), times.end());
+    double median = percentile(times, 0.5);
+    printf("%-16s %10.0f %12.0f %8.3f %10.1f %10.1f %10.1f\n",
+           workload.name.c_str(),
+           workload.primitives / median * 1e9,
+           pixels / median * 1e9,
+           pixels ? median / pixels : 0.0,
+           median / 1e3, percentile(times, 0.9) / 1e3, percentile(times, 0.99) / 1e3);
+}
+
+//Тор вокруг оси z: rings сечений по большому кругу, sides - по малому
+Mesh torusMesh(float radius, float tube, int rings, int sides) {
+    Mesh mesh;
+    for (int i = 0; i < rings; i++) {
+        float u = 2 * M_PI * i / rings;
+        for (int j = 0; j < sides; j++) {
+            float v = 2 * M_PI * j / sides;
+            float distance = radius + tube * cos(v);
+            mesh.addVertex(distance * cos(u), distance * sin(u), tube * sin(v));
+        }
+    }
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            unsigned int a = i * sides + j;
+            unsigned int b = (i + 1) % rings * sides + j;
+            unsigned int c = (i + 1) % rings * sides + (j + 1) % sides;
+            unsigned int d = i * sides + (j + 1) % sides;
+            mesh.addFace(vector<unsigned int>{a, b, c, d});
+        }
+    }
+    return mesh;
+}
+
+vector<BenchWorkload> benchWorkloads(int size, size_t count) {
+    mt19937 random(12345);
+    auto coord = [&](int range) { return (int)(random() % (range * 2)) - range / 2; };
+    vector<Segment> lines(count);
+    for (size_t i = 0; i < count; i++) {
+        lines[i].y_start = coord(size);
+        lines[i].x_start = coord(size);
+        lines[i].y_end = coord(size);
+        lines[i].x_end = coord(size);
+    }
+    vector<int> circles(count * 3);
+    for (size_t i = 0; i < count; i++) {
+        circles[3 * i] = random() % size;
+        circles[3 * i + 1] = random() % size;
+        circles[3 * i + 2] = random() % (size / 8 + 1);
+    }
+    vector<int> triangles(count * 6);
+    for (size_t i = 0; i < count * 6; i++)
+        triangles[i] = random() % size;
+    vector<BenchWorkload> workloads;
+    workloads.push_back({"line", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < lines.size(); i++)
+            brezenchemAlgorithm(canvas, lines[i].y_start, lines[i].x_start, lines[i].y_end, lines[i].x_end);
+    }});
+    workloads.push_back({"line-runslice", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < lines.size(); i++)
+            runSliceAlgorithm(canvas, lines[i].y_start, lines[i].x_start, lines[i].y_end, lines[i].x_end);
+    }});
+    workloads.push_back({"line-batch", count, [=](Canvas& canvas) {
+        drawLines(canvas, lines);
+    }});
+    workloads.push_back({"circle", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < count; i++)
+            drawCircle(canvas, circles[3 * i], circles[3 * i + 1], circles[3 * i + 2]);
+    }});
+    workloads.push_back({"circle-fill", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < count; i++)
+            fillCircle(canvas, circles[3 * i], circles[3 * i + 1], circles[3 * i + 2]);
+    }});
+    workloads.push_back({"triangle", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < count; i++) {
+            const int* v = &triangles[6 * i];
+            drawTriangle(canvas, v[0], v[1], v[2], v[3], v[4], v[5]);
+        }
+    }});
+    workloads.push_back({"triangle-fill", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < count; i++) {
+            const int* v = &triangles[6 * i];
+            fillTriangle(canvas, v[0], v[1], v[2], v[3], v[4], v[5]);
+        }
+    }});
+    vector<int> curves(count * 8);
+    for (size_t i = 0; i < count * 8; i++)
+        curves[i] = coord(size);
+    workloads.push_back({"bezier", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < count; i++) {
+            const int* v = &curves[8 * i];
+            drawCubicBezier(canvas, Point{v[0], v[1]}, Point{v[2], v[3]}, Point{v[4], v[5]}, Point{v[6], v[7]});
+        }
+    }});
+    //тор из 64x32 четырёхугольников под перспективой: половина граней
+    //повёрнута от камеры, часть рёбер закрыта самим тором
+    Mesh torus = torusMesh(1, 0.4f, 64, 32);
+    Matrix4 torusTransform = Matrix4::perspective(1.0f, 1.0f, 0.5f, 50) * Matrix4::translation(0, 0, -3) *
+                             Matrix4::rotation(0, 1.0f) * Matrix4::rotation(2, 0.3f);
+    shared_ptr<WireframeRenderer> renderer = make_shared<WireframeRenderer>();
+    shared_ptr<DepthBuffer> depth = make_shared<DepthBuffer>(size, size);
+    workloads.push_back({"wireframe", torus.getEdges().size(), [=](Canvas& canvas) {
+        renderer->draw(canvas, torus, torusTransform);
+    }});
+    workloads.push_back({"wireframe-depth", torus.getEdges().size(), [=](Canvas& canvas) {
+        depth->clear();
+        renderer->draw(canvas, torus, torusTransform, depth.get());
+    }});
+    //наложение спрайтов-надписей 4x24 на каждом уровне ядер
+    const int SPRITE_KINDS = 16;
+    vector<shared_ptr<Canvas>> sprites;
+    for (int k = 0; k < SPRITE_KINDS; k++) {
+        sprites.push_back(make_shared<Canvas>(4, 24));
+        for (int y = 0; y < 4; y++)
+            for (int x = 0; x < 24; x++)
+                if (random() % 3 == 0)
+                    sprites.back()->setElement(y, x, "#*+"[random() % 3]);
+    }
+    vector<int> places(count * 2);
+    for (size_t i = 0; i < count * 2; i++)
+        places[i] = (int)(random() % (size + 24)) - 12;
+    const char* levelNames[] = {"stamp-scalar", "stamp-sse2", "stamp-avx2"};
+    for (int level = 0; level < 3; level++) {
+        if ((int)supportedSimdLevel() < level)
+            continue;
+        workloads.push_back({levelNames[level], count, [=](Canvas& canvas) {
+            SimdLevel previous = activeSimdLevel;
+            setSimdLevel((SimdLevel)level);
+            for (size_t i = 0; i < count; i++)
+                canvas.stamp(*sprites[i % SPRITE_KINDS], places[2 * i], places[2 * i + 1]);
+            setSimdLevel(previous);
+        }});
+    }
+    //то же по ячейке через setElement
+    workloads.push_back({"stamp-cells", count, [=](Canvas& canvas) {
+        for (size_t i = 0; i < count; i++) {
+            const Canvas& sprite = *sprites[i % SPRITE_KINDS];
+            for (int y = 0; y < 4; y++)
+                for (int x = 0; x < 24; x++) {
+                    char value = sprite.getElement(y, x);
+                    if (value != ' ' && canvas.contains(places[2 * i] + y, places[2 * i + 1] + x))
+                        canvas.setElement(places[2 * i] + y, places[2 * i + 1] + x, value);
+                }
+        }
+    }});
+    //кадр демонстрации: немного коротких отрезков, очистка прошлого кадра
+    //и сборка текста - работа пропорциональна изменённым плиткам
+    const size_t SPARSE_LINES = 16;
+    vector<Segment> shortLines(SPARSE_LINES);
+    for (size_t i = 0; i < SPARSE_LINES; i++) {
+        shortLines[i].y_start = random() % size;
+        shortLines[i].x_start = random() % size;
+        shortLines[i].y_end = shortLines[i].y_start + (int)(random() % 41) - 20;
+        shortLines[i].x_end = shortLines[i].x_start + (int)(random() % 41) - 20;
+    }
+    workloads.push_back({"sparse-frame", SPARSE_LINES, [=](Canvas& canvas) {
+        canvas.clear();
+        for (size_t i = 0; i < shortLines.size(); i++)
+            brezenchemAlgorithm(canvas, shortLines[i].y_start, shortLines[i].x_start,
+                                shortLines[i].y_end, shortLines[i].x_end);
+        canvas.frame();
+    }});
+    return workloads;
+}
+
+//Эталонные скалярные реализации: по пикселю за раз, с проверкой границ.
+//Оптимизированные растеризаторы должны совпадать с ними побайтно
+void referenceLine(Canvas& canvas, int y_start, int x_start, int y_end, int x_end) {
+    int dx = abs(x_end - x_start);
+    int dy = abs(y_end - y_start);
+    int stepX = (x_start < x_end) ? 1 : -1;
+    int stepY = (y_start < y_end) ? 1 : -1;
+    int x = x_start;
+    int y = y_start;
+    int error = 0;
+    plotClipped(canvas, y, x);
+    if (dx >= dy) {
+        for (int i = 1; i <= dx; i++) {
+            x += stepX;
+            error += 2 * dy;
+            if (error >= dx) {
+                error -= 2 * dx;
+                y += stepY;
+            }
+            plotClipped(canvas, y, x);
+        }
+    } else {
+        for (int i = 1; i <= dy; i++) {
+            y += stepY;
+            error += 2 * dx;
+            if (error >= dy) {
+                error -= 2 * dy;
+                x += stepX;
+            }
+            plotClipped(canvas, y, x);
+        }
+    }
+}
+
+//Заливка строк между крайними точками контура
+void referenceFillRows(Canvas& canvas) {
+    for (unsigned int y = 0; y < canvas.getHeight(); y++) {
+        int left = -1, right = -1;
+        for (unsigned int x = 0; x < canvas.getWidth(); x++) {
+            if (canvas.row(y)[x] != ' ') {
+                if (left < 0)
+                    left = x;
+                right = x;
+            }
+        }
+        if (left >= 0)
+            canvas.fillSpan(y, left, right, '*');
+    }
+}
+
+void referenceFillTriangle(Canvas& canvas, int x1, int y1, int x2, int y2, int x3, int y3) {
+    long long area = (long long)(x2 - x1) * (y3 - y1) - (long long)(y2 - y1) * (x3 - x1);
+    if (area == 0)
+        return;
+    if (area < 0) {
+        swap(x2, x3);
+        swap(y2, y3);
+    }
+    EdgeFunction edges[3];
+    edges[0].setup(x1, y1, x2, y2);
+    edges[1].setup(x2, y2, x3, y3);
+    edges[2].setup(x3, y3, x1, y1);
+    for (unsigned int y = 0; y < canvas.getHeight(); y++)
+        for (unsigned int x = 0; x < canvas.getWidth(); x++)
+            if (edges[0].at(x, y) >= 0 && edges[1].at(x, y) >= 0 && edges[2].at(x, y) >= 0)
+                canvas.setElement(y, x, '*');
+}
+
+//Проверка точки по числу пересечений луча влево с рёбрами
+void referenceFillPolygon(Canvas& canvas, const vector<Point>& points, FillRule rule) {
+    for (unsigned int y = 0; y < canvas.getHeight(); y++) {
+        for (unsigned int x = 0; x < canvas.getWidth(); x++) {
+            int crossings = 0, winding = 0;
+            for (size_t i = 0; i < points.size(); i++) {
+                Point from = points[i];
+                Point to = points[(i + 1) % points.size()];
+                int direction = 1;
+                if (from.y == to.y)
+                    continue;
+                if (from.y > to.y) {
+                    swap(from, to);
+                    direction = -1;
+                }
+                if ((int)y < from.y || (int)y >= to.y)
+                    continue;
+                long long numerator = (long long)from.x * (to.y - from.y) + (long long)((int)y - from.y) * (to.x - from.x);
+                if (ceilDiv(numerator, to.y - from.y) <= x) {
+                    crossings++;
+                    winding += direction;
+                }
+            }
+            if (rule == FillRule::EvenOdd ? crossings % 2 == 1 : winding != 0)
+                canvas.setElement(y, x, '*');
+        }
+    }
+}
+
+//Заливка по пикселю: обход в ширину по 4 соседям
+void referenceFloodFill(Canvas& canvas, int y, int x) {
+    if (!canvas.contains(y, x))
+        return;
+    char target = canvas.getElement(y, x);
+    if (target == '*')
+        return;
+    vector<pair<int, int>> queue(1, make_pair(y, x));
+    canvas.setElement(y, x, '*');
+    for (size_t i = 0; i < queue.size(); i++) {
+        const int dy[] = {1, -1, 0, 0};
+        const int dx[] = {0, 0, 1, -1};
+        for (int k = 0; k < 4; k++) {
+            int ny = queue[i].first + dy[k];
+            int nx = queue[i].second + dx[k];
+            if (canvas.contains(ny, nx) && canvas.getElement(ny, nx) == target) {
+                canvas.setElement(ny, nx, '*');
+                queue.push_back(make_pair(ny, nx));
+            }
+        }
+    }
+}
+
+bool sameCanvas(const Canvas& a, const Canvas& b) {
+    for (unsigned int y = 0; y < a.getHeight(); y++)
+        if (memcmp(a.row(y), b.row(y), a.getWidth()) != 0)
+            return false;
+    return true;
+}
+
+//Сравнение оптимизированного пути с эталоном на случайных фигурах,
+//в том числе частично и полностью за пределами холста
+//Замер только самого примитива: подготовка входа и перенос результата
+//на проверочный холст в замер не входят
+struct CheckTimer {
+    double micros = 0;
+    template <class F>
+    void measure(F primitive) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        primitive();
+        micros += chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+    }
+};
+
+struct EquivalenceCheck {
+    string name;
+    function<void(mt19937&, Canvas&, bool, CheckTimer&)> render;
+};
+
+//Набор фигур для сравнения холстов разного устройства: значения
+//координат берутся из генератора до рисования, порядок вызовов одинаков
+template <class C>
+void drawMixedScene(C& canvas, const vector<int>& v) {
+    brezenchemAlgorithm(canvas, v[0], v[1], v[2], v[3]);
+    runSliceAlgorithm(canvas, v[4], v[5], v[6], v[7]);
+    drawCircle(canvas, v[8], v[9], abs(v[10]) / 2);
+    fillCircle(canvas, v[11], v[12], abs(v[13]) / 4);
+    fillEllipse(canvas, v[14], v[15], abs(v[16]) / 3, abs(v[17]) / 5);
+    fillTriangle(canvas, v[18], v[19], v[20], v[21], v[22], v[23]);
+    vector<Point> points;
+    for (int i = 24; i + 1 < 32; i += 2)
+        points.push_back(Point{v[i], v[i + 1]});
+    fillPolygon(canvas, points, FillRule::NonZero);
+    vector<Segment> segments;
+    segments.push_back(Segment{v[32], v[33], v[34], v[35]});
+    drawLines(canvas, segments);
+}
+
+vector<EquivalenceCheck> equivalenceChecks() {
+    vector<EquivalenceCheck> checks;
+    auto coord = [](mt19937& random, int size) { return (int)(random() % (size * 2)) - size / 2; };
+    typedef void (*Line)(Canvas&, int, int, int, int);
+    Line lines[] = {brezenchemAlgorithm, runSliceAlgorithm};
+    const char* lineNames[] = {"line", "line-runslice"};
+    for (int k = 0; k < 2; k++) {
+        Line line = lines[k];
+        checks.push_back({lineNames[k], [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+            int size = canvas.getWidth();
+            int y0 = coord(random, size), x0 = coord(random, size);
+            int y1 = coord(random, size), x1 = coord(random, size);
+            timer.measure([&] { (reference ? referenceLine : line)(canvas, y0, x0, y1, x1); });
+        }});
+    }
+    checks.push_back({"line-batch", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        vector<Segment> segments(64);
+        for (size_t i = 0; i < segments.size(); i++) {
+            segments[i].y_start = coord(random, size);
+            segments[i].x_start = coord(random, size);
+            segments[i].y_end = coord(random, size);
+            segments[i].x_end = coord(random, size);
+        }
+        timer.measure([&] {
+            if (!reference) {
+                drawLines(canvas, segments);
+                return;
+            }
+            for (size_t i = 0; i < segments.size(); i++)
+                referenceLine(canvas, segments[i].y_start, segments[i].x_start, segments[i].y_end, segments[i].x_end);
+        });
+    }});
+    checks.push_back({"line-batch-strips", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        //раскладка по полосам на двух потоках при любом числе ядер
+        static ThreadPool pool(2);
+        int size = canvas.getWidth();
+        vector<Segment> segments(LINES_SERIAL_BATCH);
+        for (size_t i = 0; i < segments.size(); i++) {
+            segments[i].y_start = coord(random, size);
+            segments[i].x_start = coord(random, size);
+            segments[i].y_end = coord(random, size);
+            segments[i].x_end = coord(random, size);
+        }
+        timer.measure([&] {
+            if (!reference) {
+                drawLines(canvas, &segments[0], segments.size(), pool);
+                return;
+            }
+            for (size_t i = 0; i < segments.size(); i++)
+                referenceLine(canvas, segments[i].y_start, segments[i].x_start, segments[i].y_end, segments[i].x_end);
+        });
+    }});
+    checks.push_back({"circle-fill", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        int xc = coord(random, size), yc = coord(random, size), r = random() % size;
+        if (!reference) {
+            timer.measure([&] { fillCircle(canvas, xc, yc, r); });
+            return;
+        }
+        //контур рисуется на холсте с полями, чтобы крайние строки не обрезались
+        Canvas big(5 * size, 5 * size);
+        timer.measure([&] {
+            drawCircle(big, xc + 2 * size, yc + 2 * size, r);
+            referenceFillRows(big);
+        });
+        canvas.blit(big, -2 * size, -2 * size);
+    }});
+    checks.push_back({"ellipse-fill", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        int xc = coord(random, size), yc = coord(random, size);
+        int rx = random() % size, ry = random() % size;
+        if (!reference) {
+            timer.measure([&] { fillEllipse(canvas, xc, yc, rx, ry); });
+            return;
+        }
+        Canvas big(5 * size, 5 * size);
+        timer.measure([&] {
+            drawEllipse(big, xc + 2 * size, yc + 2 * size, rx, ry);
+            referenceFillRows(big);
+        });
+        canvas.blit(big, -2 * size, -2 * size);
+    }});
+    checks.push_back({"triangle-fill", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        int v[6];
+        for (int i = 0; i < 6; i++)
+            v[i] = coord(random, size);
+        timer.measure([&] {
+            (reference ? referenceFillTriangle : fillTriangle<Canvas>)(canvas, v[0], v[1], v[2], v[3], v[4], v[5]);
+        });
+    }});
+    checks.push_back({"polygon-fill", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        vector<Point> points(3 + random() % 10);
+        for (size_t i = 0; i < points.size(); i++) {
+            points[i].x = coord(random, size);
+            points[i].y = coord(random, size);
+        }
+        FillRule rule = random() % 2 ? FillRule::EvenOdd : FillRule::NonZero;
+        timer.measure([&] {
+            if (reference)
+                referenceFillPolygon(canvas, points, rule);
+            else
+                fillPolygon(canvas, points, rule);
+        });
+    }});
+    checks.push_back({"flood-fill", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        int v[12];
+        for (int i = 0; i < 12; i++)
+            v[i] = coord(random, size);
+        drawTriangle(canvas, v[0], v[1], v[2], v[3], v[4], v[5]);
+        drawCircle(canvas, v[6], v[7], abs(v[8]));
+        brezenchemAlgorithm(canvas, v[9], v[10], v[11], v[0]);
+        int y = random() % size, x = random() % size;
+        timer.measure([&] {
+            if (reference)
+                referenceFloodFill(canvas, y, x);
+            else
+                floodFill(canvas, y, x);
+        });
+    }});
+    checks.push_back({"path", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        Path path;
+        path.moveTo(coord(random, size), coord(random, size));
+        for (int k = 1 + random() % 4; k > 0; k--) {
+            int v[6];
+            for (int i = 0; i < 6; i++)
+                v[i] = coord(random, size);
+            if (k % 3 == 0)
+                path.lineTo(v[0], v[1]);
+            else if (k % 3 == 1)
+                path.quadTo(v[0], v[1], v[2], v[3]);
+            else
+                path.cubicTo(v[0], v[1], v[2], v[3], v[4], v[5]);
+        }
+        if (random() % 2)
+            path.close();
+        if (!reference) {
+            timer.measure([&] { drawPath(canvas, path); });
+            return;
+        }
+        //эталон: те же вершины отдельными отрезками
+        const Path::Contour& contour = path.getContours()[0];
+        const vector<Point>& v = contour.points;
+        timer.measure([&] {
+            referenceLine(canvas, v[0].y, v[0].x, v[0].y, v[0].x);
+            for (size_t i = 0; i + 1 < v.size(); i++)
+                referenceLine(canvas, v[i].y, v[i].x, v[i + 1].y, v[i + 1].x);
+            if (contour.closed)
+                referenceLine(canvas, v.back().y, v.back().x, v[0].y, v[0].x);
+        });
+    }});
+    checks.push_back({"tiled-canvas", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        vector<int> v(36);
+        for (size_t i = 0; i < v.size(); i++)
+            v[i] = coord(random, size);
+        if (reference) {
+            timer.measure([&] { drawMixedScene(canvas, v); });
+            return;
+        }
+        //мелкие плитки 16x16, чтобы фигуры пересекали их границы
+        BasicTiledCanvas<char, 4> tiled(canvas.getHeight(), canvas.getWidth());
+        timer.measure([&] { drawMixedScene(tiled, v); });
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++)
+                canvas.setElement(y, x, tiled.getElement(y, x));
+    }});
+    checks.push_back({"wireframe", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        //вершины перед камерой: векторное преобразование против поточечного
+        Mesh mesh;
+        int vertices = 1 + random() % 23;
+        for (int i = 0; i < vertices; i++)
+            mesh.addVertex((int)(random() % 601) / 100.0f - 3, (int)(random() % 601) / 100.0f - 3,
+                           -2 - (int)(random() % 801) / 100.0f);
+        for (int i = 0; i + 1 < vertices; i++)
+            mesh.addEdge(random() % (i + 1), i + 1);
+        Matrix4 transform = Matrix4::perspective(1.2f, 1.0f, 0.5f, 50) * Matrix4::rotation(2, (int)(random() % 628) / 100.0f);
+        if (!reference) {
+            timer.measure([&] { drawWireframe(canvas, mesh, transform); });
+            return;
+        }
+        timer.measure([&] {
+            Matrix4 full = Matrix4::viewport(canvas.getHeight(), canvas.getWidth()) * transform;
+            vector<int> x(vertices), y(vertices);
+            for (int i = 0; i < vertices; i++) {
+                float v[4] = {mesh.getX()[i], mesh.getY()[i], mesh.getZ()[i], 1};
+                float row[4];
+                for (int r = 0; r < 4; r++)
+                    row[r] = full.m[4 * r] * v[0] + full.m[4 * r + 1] * v[1] + full.m[4 * r + 2] * v[2] + full.m[4 * r + 3];
+                float inverse = 1.0f / row[3];
+                x[i] = (int)floor(row[0] * inverse + 0.5f);
+                y[i] = (int)floor(row[1] * inverse + 0.5f);
+            }
+            for (size_t e = 0; e < mesh.getEdges().size(); e++) {
+                const MeshEdge& edge = mesh.getEdges()[e];
+                referenceLine(canvas, y[edge.a], x[edge.a], y[edge.b], x[edge.b]);
+            }
+        });
+    }});
+    checks.push_back({"composite", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        //char-холсты с двумя видами ячеек или Bit-холсты, уровень ядер - случайный
+        bool bits = random() % 2;
+        const char cells[] = {' ', ' ', '*', '#'};
+        int cellKinds = bits ? 3 : 4;
+        int spriteHeight = 1 + random() % 40, spriteWidth = 1 + random() % 80;
+        vector<char> before((size_t)size * size), sprite((size_t)spriteHeight * spriteWidth);
+        for (size_t i = 0; i < before.size(); i++)
+            before[i] = cells[random() % cellKinds];
+        for (size_t i = 0; i < sprite.size(); i++)
+            sprite[i] = cells[random() % cellKinds];
+        Composite op = (Composite)(random() % 4);
+        int sourceY = (int)(random() % 50) - 5, sourceX = (int)(random() % 90) - 5;
+        int rectHeight = random() % 50, rectWidth = random() % 90;
+        int y = coord(random, size), x = coord(random, size);
+        SimdLevel level = (SimdLevel)(random() % 3);
+        if (reference) {
+            for (int row = 0; row < size; row++)
+                for (int column = 0; column < size; column++)
+                    canvas.setElement(row, column, before[(size_t)row * size + column]);
+            timer.measure([&] {
+                for (int row = 0; row < rectHeight; row++) {
+                    for (int column = 0; column < rectWidth; column++) {
+                        int fromY = sourceY + row, fromX = sourceX + column;
+                        int toY = y + row, toX = x + column;
+                        if (fromY < 0 || fromX < 0 || fromY >= spriteHeight || fromX >= spriteWidth || !canvas.contains(toY, toX))
+                            continue;
+                        char value = sprite[(size_t)fromY * spriteWidth + fromX];
+                        canvas.setElement(toY, toX, compositeValue(op, canvas.getElement(toY, toX), value, ' '));
+                    }
+                }
+            });
+            return;
+        }
+        SimdLevel previous = activeSimdLevel;
+        setSimdLevel(level);
+        if (bits) {
+            BitCanvas target(size, size), source(spriteHeight, spriteWidth);
+            for (int row = 0; row < size; row++)
+                for (int column = 0; column < size; column++)
+                    target.setElement(row, column, before[(size_t)row * size + column] != ' ');
+            for (int row = 0; row < spriteHeight; row++)
+                for (int column = 0; column < spriteWidth; column++)
+                    source.setElement(row, column, sprite[(size_t)row * spriteWidth + column] != ' ');
+            timer.measure([&] { target.composite(source, sourceY, sourceX, rectHeight, rectWidth, y, x, op); });
+            for (int row = 0; row < size; row++)
+                for (int column = 0; column < size; column++)
+                    canvas.setElement(row, column, target.getElement(row, column) ? '*' : ' ');
+        } else {
+            Canvas source(spriteHeight, spriteWidth);
+            for (int row = 0; row < size; row++)
+                memcpy(canvas.row(row), &before[(size_t)row * size], size);
+            canvas.markDirty(0, 0, size - 1, size - 1);
+            for (int row = 0; row < spriteHeight; row++)
+                memcpy(source.row(row), &sprite[(size_t)row * spriteWidth], spriteWidth);
+            timer.measure([&] { canvas.composite(source, sourceY, sourceX, rectHeight, rectWidth, y, x, op); });
+        }
+        setSimdLevel(previous);
+    }});
+    checks.push_back({"frame-ring", [=](mt19937& random, Canvas& canvas, bool reference, CheckTimer& timer) {
+        int size = canvas.getWidth();
+        vector<vector<int>> scenes(5, vector<int>(36));
+        for (size_t k = 0; k < scenes.size(); k++)
+            for (size_t i = 0; i < scenes[k].size(); i++)
+                scenes[k][i] = coord(random, size);
+        if (reference) {
+            timer.measure([&] { drawMixedScene(canvas, scenes.back()); });
+            return;
+        }
+        //кадров больше, чем ячеек: ячейки дописываются только изменёнными плитками
+        FrameRing ring("/zeroLab-verify-" + to_string(getpid()), canvas, 2);
+        FrameRingReader reader;
+        reader.open("/zeroLab-verify-" + to_string(getpid()));
+        uint64_t number = 0;
+        for (size_t k = 0; k < scenes.size(); k++) {
+            canvas.clear();
+            drawMixedScene(canvas, scenes[k]);
+            timer.measure([&] { number = ring.publish(canvas); });
+        }
+        canvas.clear();
+        timer.measure([&] {
+            reader.read(number, [&](const char* pixels) {
+                for (int y = 0; y < size; y++)
+                    memcpy(canvas.row(y), pixels + (size_t)y * reader.info().stride, size);
+            });
+        });
+        canvas.markDirty(0, 0, size - 1, size - 1);
+    }});
+    return checks;
+}
+
+string renderDemoCase(const DemoCase& demo, double& micros) {
+    Canvas canvas(20, 20);
+    ofstream none;
+    vector<string> frames;
+    capturedFrames = &frames;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    demo.run(canvas, none);
+    chrono::steady_clock::time_point end = chrono::steady_clock::now();
+    capturedFrames = nullptr;
+    micros = chrono::duration<double, micro>(end - start).count();
+    string text;
+    for (size_t i = 0; i < frames.size(); i++)
+        text += frames[i];
+    return text;
+}
+
+//Файл эталонных кадров: для каждого случая строка "== имя длина", затем кадры
+void recordFrames(const string& filename) {
+    ofstream file(filename, std::ios::trunc | std::ios::binary);
+    vector<DemoCase> cases = demoCases();
+    for (size_t i = 0; i < cases.size(); i++) {
+        double micros;
+        string text = renderDemoCase(cases[i], micros);
+        file << "== " << cases[i].name << " " << text.size() << "\n";
+        file.write(text.data(), text.size());
+    }
+    std::cout << "recorded " << cases.size() << " cases to " << filename << std::endl;
+}
+
+bool loadFrames(const string& filename, vector<pair<string, string>>& frames) {
+    ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    string marker, name;
+    size_t size;
+    while (file >> marker >> name >> size) {
+        file.get();
+        string text(size, '\0');
+        file.read(&text[0], size);
+        frames.push_back(make_pair(name, text));
+    }
+    return true;
+}
+
+//Замедление проверки относительно сохранённого замера: больше чем в
+//TIMING_WARN_RATIO раз - предупреждение, больше чем в TIMING_FAIL_RATIO раз -
+//провал. Разница меньше TIMING_NOISE_US - шум таймера и планировщика
+const double TIMING_WARN_RATIO = 1.5;
+const double TIMING_FAIL_RATIO = 3.0;
+const double TIMING_NOISE_US = 1000;
+
+struct CheckResult {
+    int mismatches;
+    //суммарное время примитивов за все раунды
+    double fastMicros;
+    double referenceMicros;
+};
+
+CheckResult runCheck(const EquivalenceCheck& check, unsigned int seed, int rounds) {
+    mt19937 random(seed);
+    CheckTimer fastTimer, referenceTimer;
+    CheckResult result = {0, 0, 0};
+    for (int round = 0; round < rounds; round++) {
+        int size = 1 + random() % 96;
+        Canvas fast(size, size), reference(size, size);
+        //оба холста рисуются с одного и того же состояния генератора
+        mt19937 referenceRandom = random;
+        check.render(random, fast, false, fastTimer);
+        check.render(referenceRandom, reference, true, referenceTimer);
+        if (!sameCanvas(fast, reference))
+            result.mismatches++;
+        //очистка только отмеченных плиток должна вернуть чистый холст
+        fast.clear();
+        if (!sameCanvas(fast, Canvas(size, size)))
+            result.mismatches++;
+    }
+    result.fastMicros = fastTimer.micros;
+    result.referenceMicros = referenceTimer.micros;
+    return result;
+}
+
+//Файл замеров: строка "имя микросекунды" на проверку
+void recordTimings(const string& filename, int rounds) {
+    ofstream file(filename, std::ios::trunc);
+    vector<EquivalenceCheck> checks = equivalenceChecks();
+    for (size_t i = 0; i < checks.size(); i++) {
+        CheckResult result = runCheck(checks[i], 777 + i, rounds);
+        char line[128];
+        snprintf(line, sizeof(line), "%s %.1f\n", checks[i].name.c_str(), result.fastMicros);
+        file << line;
+    }
+    std::cout << "recorded " << checks.size() << " timings to " << filename << std::endl;
+}
+
+bool loadTimings(const string& filename, unordered_map<string, double>& timings) {
+    ifstream file(filename);
+    if (!file.is_open())
+        return false;
+    string name;
+    double micros;
+    while (file >> name >> micros)
+        timings[name] = micros;
+    return true;
+}
+
+int verify(const string& framesFile, const string& timingsFile, int rounds) {
+    int failures = 0;
+    unordered_map<string, double> baseline;
+    if (!timingsFile.empty() && !loadTimings(timingsFile, baseline)) {
+        std::cout << "cannot open " << timingsFile << std::endl;
+        return 1;
+    }
+    printf("%-22s %8s %12s %12s %12s\n", "check", "result", "fast us", "reference us", "baseline us");
+    vector<EquivalenceCheck> checks = equivalenceChecks();
+    for (size_t i = 0; i < checks.size(); i++) {
+        CheckResult check = runCheck(checks[i], 777 + i, rounds);
+        const char* result = check.mismatches ? "FAIL" : "ok";
+        unordered_map<string, double>::const_iterator saved = baseline.find(checks[i].name);
+        double base = saved != baseline.end() ? saved->second : 0;
+        if (base > 0 && !check.mismatches && check.fastMicros - base > TIMING_NOISE_US) {
+            if (check.fastMicros > base * TIMING_FAIL_RATIO)
+                result = "SLOW";
+            else if (check.fastMicros > base * TIMING_WARN_RATIO)
+                result = "slower";
+        }
+        printf("%-22s %8s %12.1f %12.1f %12.1f\n", checks[i].name.c_str(), result,
+               check.fastMicros, check.referenceMicros, base);
+        failures += check.mismatches != 0 || string(result) == "SLOW";
+    }
+    if (!framesFile.empty()) {
+        vector<pair<string, string>> expected;
+        if (!loadFrames(framesFile, expected)) {
+            std::cout << "cannot open " << framesFile << std::endl;
+            return 1;
+        }
+        vector<DemoCase> cases = demoCases();
+        for (size_t i = 0; i < cases.size(); i++) {
+            double micros;
+            string text = renderDemoCase(cases[i], micros);
+            const char* result = "missing";
+            for (size_t k = 0; k < expected.size(); k++)
+                if (expected[k].first == cases[i].name)
+                    result = expected[k].second == text ? "ok" : "FAIL";
+            printf("%-22s %8s %12.1f\n", cases[i].name.c_str(), result, micros);
+            failures += string(result) != "ok";
+        }
+        //конвейер без пауз должен выдать те же кадры в том же порядке
+        string sequential;
+        double sequentialTime = 0;
+        for (size_t i = 0; i < cases.size(); i++) {
+            double micros;
+            sequential += renderDemoCase(cases[i], micros);
+            sequentialTime += micros;
+        }
+        FramePipeline pipeline(20, 20, 3, 5);
+        FrameClock unpaced(0);
+        string piped;
+        ofstream none;
+        framePipeline = &pipeline;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        pipeline.run(cases.size(), [&](size_t job, Canvas& canvas) {
+            cases[job].run(canvas, none);
+        }, [&](Canvas& frame, const string&) {
+            piped += frame.frame();
+        }, unpaced);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        framePipeline = nullptr;
+        const char* result = piped == sequential ? "ok" : "FAIL";
+        printf("%-22s %8s %12.1f %12.1f\n", "pipeline", result,
+               chrono::duration<double, micro>(end - start).count(), sequentialTime);
+        failures += piped != sequential;
+    }
+    std::cout << (failures ? "FAILED" : "PASSED") << std::endl;
+    return failures ? 1 : 0;
+}
+
+//zeroLab_bench [итерации] [размер холста] [примитивов за итерацию] [фильтр имени]
+//zeroLab_bench --verify [файл эталонных кадров] [файл замеров]
+//zeroLab_bench --record файл эталонных кадров
+//zeroLab_bench --record-timings файл замеров (замеры зависят от машины,
+//после смены машины или компилятора их записывают заново)
+int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]) == "--verify")
+        return verify(argc > 2 ? argv[2] : "", argc > 3 ? argv[3] : "", 2000);
+    if (argc > 2 && string(argv[1]) == "--record") {
+        recordFrames(argv[2]);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--record-timings") {
+        recordTimings(argv[2], 2000);
+        return 0;
+    }
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+    int size = argc > 2 ? atoi(argv[2]) : 1000;
+    int count = argc > 3 ? atoi(argv[3]) : 1000;
+    string filter = argc > 4 ? argv[4] : "";
+    if (iterations <= 0 || size <= 0 || count <= 0) {
+        std::cout << "usage: zeroLab_bench [iterations] [size] [primitives] [filter]" << std::endl;
+        return 1;
+    }
+    Canvas canvas(size, size);
+    printf("canvas %dx%d, %d primitives, %d iterations, %u threads\n",
+           size, size, count, iterations, defaultThreadPool().size());
+    printf("%-16s %10s %12s %8s %10s %10s %10s\n",
+           "workload", "prims/s", "pixels/s", "ns/px", "p50 us", "p90 us", "p99 us");
+    vector<BenchWorkload> workloads = benchWorkloads(size, count);
+    for (size_t i = 0; i < workloads.size(); i++)
+        if (workloads[i].name.find(filter) != string::npos)
+            runBenchmark(canvas, workloads[i], iterations);
+    return 0;
+}
+#elif defined(ZEROLAB_READER)
+//Кадр из ячейки кольца в рамке, в том же виде, что Canvas::frame()
+void appendFramed(string& text, const FrameRingHeader& info, const char* pixels) {
+    text.append(info.width, '-');
+    text.push_back('\n');
+    for (unsigned int y = 0; y < info.height; y++) {
+        text.push_back('|');
+        text.append(pixels + (size_t)y * info.stride, info.width);
+        text.append("|\n");
+    }
+    text.append(info.width, '-');
+    text.push_back('\n');
+}
+
+//FNV-1a по видимой части строк кадра
+uint64_t frameHash(const FrameRingHeader& info, const char* pixels) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned int y = 0; y < info.height; y++) {
+        const unsigned char* row = reinterpret_cast<const unsigned char*>(pixels + (size_t)y * info.stride);
+        for (unsigned int x = 0; x < info.width; x++)
+            hash = (hash ^ row[x]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+//zeroLab_reader [--check] [имя кольца] [кадров, 0 - без конца]
+//Кадры печатаются по мере публикации; с --check вместо кадра печатается
+//его контрольная сумма, посчитанная прямо в кольце. Кадры, которые писатель
+//успел перезаписать до чтения, считаются пропущенными
+int main(int argc, char** argv) {
+    int arg = 1;
+    bool check = arg < argc && string(argv[arg]) == "--check";
+    if (check)
+        arg++;
+    string name = arg < argc ? argv[arg++] : FRAME_RING_NAME;
+    unsigned long long limit = arg < argc ? strtoull(argv[arg], nullptr, 10) : 0;
+    FrameRingReader reader;
+    //кольцо может появиться позже читателя
+    while (!reader.open(name))
+        this_thread::sleep_for(chrono::milliseconds(100));
+    const FrameRingHeader& info = reader.info();
+    uint64_t next = max(reader.published(), (uint64_t)1);
+    unsigned long long received = 0, dropped = 0;
+    string text;
+    while (limit == 0 || received < limit) {
+        uint64_t published = reader.published();
+        if (published < next) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+        }
+        if (published - next >= info.slots) {
+            dropped += published - info.slots + 1 - next;
+            next = published - info.slots + 1;
+        }
+        uint64_t hash = 0;
+        text.clear();
+        bool complete = reader.read(next, [&](const char* pixels) {
+            if (check)
+                hash = frameHash(info, pixels);
+            else
+                appendFramed(text, info, pixels);
+        });
+        if (!complete) {
+            dropped++;
+        } else if (check) {
+            printf("frame %llu %016llx\n", (unsigned long long)next, (unsigned long long)hash);
+            received++;
+        } else {
+            std::cout.write(text.data(), text.size());
+            std::cout.flush();
+            received++;
+        }
+        next++;
+    }
+    printf("received %llu, dropped %llu\n", received, dropped);
+    return 0;
+}
+#else
+//zeroLab [--diff] [--shm [имя кольца]] [--fps кадров в секунду] [--pipeline [потоков]]
+//С --shm кадры публикуются в кольцо в разделяемой памяти для zeroLab_reader,
+//а test.txt не переписывается. С --pipeline кадры рисуются наперёд
+//в нескольких потоках, пока поток вывода показывает готовые
+int main(int argc, char** argv) {
     Canvas canvas = Canvas(20, 20);
-    test(canvas, "test.txt");
+    TerminalView view;
+    string ringName;
+    unsigned int pipelineThreads = 0;
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        bool hasNumber = i + 1 < argc && isdigit((unsigned char)argv[i + 1][0]);
+        if (option == "--diff")
+            terminalView = &view;
+        else if (option == "--shm")
+            ringName = i + 1 < argc && argv[i + 1][0] == '/' ? argv[++i] : FRAME_RING_NAME;
+        else if (option == "--fps" && hasNumber)
+            frameClock.setRate(atof(argv[++i]));
+        else if (option == "--pipeline")
+            pipelineThreads = hasNumber ? atoi(argv[++i]) : max(thread::hardware_concurrency(), 1u);
+    }
+    unique_ptr<FrameRing> ring;
+    if (!ringName.empty()) {
+        ring.reset(new FrameRing(ringName, canvas));
+        frameStream = ring.get();
+    }
+    unique_ptr<FramePipeline> pipeline;
+    if (pipelineThreads > 0) {
+        pipeline.reset(new FramePipeline(canvas.getHeight(), canvas.getWidth(), pipelineThreads));
+        framePipeline = pipeline.get();
+    }
+    test(canvas, ring ? "" : "test.txt");
     return 0;
-}
\ No newline at end of file
+}
+#endif